@@ -0,0 +1,296 @@
+/*
+ * bench - time the Glyph engines on a set of representative workloads
+ *
+ * Every workload is first run rune by rune with glyph_step, which counts
+ * its runes and records the state each engine must finish in. Then each
+ * engine runs it to halt -n times and the fastest run is reported: runes
+ * per second, ns per rune and, where perf_event_open is allowed, host
+ * instructions, cycles, cache misses and branch misses for that run.
+ * The JIT is made before the first run and keeps its translations across
+ * runs, as a host that re-enters it would; on x86-64 bench fails if it
+ * is slower than the switch engine on any workload.
+ *
+ * Usage: bench/bench [-j] [-n runs] [-e engine] [workload]...
+ *   -j  one JSON object per workload and engine instead of a table
+ *   -e  only this engine (switch, threaded, decoded, jit)
+ */
+
+#define _GNU_SOURCE
+#define GLYPH_IMPL
+#include "../glyph.h"
+#include "../glyph_jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if GLYPH_BITS != 8
+#error "bench times the 8-bit engines"
+#endif
+
+/* Port 'c' hears from a generated input and reads 0 at its end; every
+ * emit is folded into a checksum. */
+typedef struct {
+	size_t at, len;
+	uint32_t sum;
+} BenchIO;
+
+static u8 input[1 << 20];
+
+static void io_emit(Glyph *vm, void *ctx, u8 p) {
+	BenchIO *io = ctx;
+	io->sum = io->sum * 31 + vm->p[p];
+}
+
+static void io_hear(Glyph *vm, void *ctx, u8 p) {
+	BenchIO *io = ctx;
+	vm->p[p] = io->at < io->len ? input[io->at++] : 0;
+}
+
+static const GlyphDevice bench_io = {
+	.emit = { ['c'] = io_emit, ['o'] = io_emit },
+	.hear = { ['c'] = io_hear },
+};
+
+typedef struct {
+	const char *name;
+	const char *prog;
+	size_t input;	/* bytes of input on port 'c' */
+} Work;
+
+static const Work works[] = {
+	/* arithmetic and bitwise runes in a loop of 64 * 256 passes */
+	{ "arith", "1=o 7=y .L +xa=x *xy=y ^yz=z -za=z &zy=w |wx=w +ao=a 0?!a "
+		"L=:. +co=c 64?!c L=:. `", 0 },
+	/* ;f recurses 200 deep and unwinds, 256 times */
+	{ "call", "36=. 0?!n 18:. ,. -no=n ;f +no=n ,. "
+		"1=o 5=f .L 200=n ;f +co=c 0?!c L=:. `", 0 },
+	/* sum and rewrite the upper half of the void, 64 times */
+	{ "memory", "1=o .L 128=i .M i=@<v +sv=s i=@>s +io=i 0?!i M=:. "
+		"+co=c 64?!c L=:. `", 0 },
+	/* examples/cat.g over 1 MiB of input */
+	{ "echo", ".a 'c#<c#>c 0?=c 25:a a. 0=x'X#>x", sizeof(input) },
+	/* each pass writes the next digit into its own "0=k" */
+	{ "selfmod", "1=o 10=t 48=z .L %it=d +dz=d 35@>d 0=k +sk=s +io=i "
+		"0?!i L=:. +co=c 32?!c L=:. `", 0 },
+};
+
+typedef struct {
+	const char *name;
+	void (*eval)(Glyph *vm);
+} Engine;
+
+/* Made before any run is timed, and kept across runs as a host would */
+static GlyphJit *jit;
+
+static void eval_jit(Glyph *vm) {
+	glyph_jit_run(jit, vm);
+}
+
+static const Engine engines[] = {
+	{ "switch", glyph_eval_switch },
+	{ "threaded", glyph_eval_threaded },
+	{ "decoded", glyph_eval_decoded },
+	{ "jit", eval_jit },
+};
+
+#define NWORK (int)(sizeof(works) / sizeof(works[0]))
+#define NENGINE (int)(sizeof(engines) / sizeof(engines[0]))
+
+/* Host counters of one run; have is false where perf is not available. */
+enum { PC_INS, PC_CYC, PC_MISS, PC_BMISS, PC_N };
+
+typedef struct {
+	bool have;
+	uint64_t v[PC_N];
+} Counters;
+
+static const char *pc_name[PC_N] = {
+	"instructions", "cycles", "cache_misses", "branch_misses"
+};
+
+#ifdef __linux__
+static int pc_fd[PC_N] = { -1, -1, -1, -1 };
+
+static void perf_open(void) {
+	static const uint64_t cfg[PC_N] = {
+		PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+	};
+	for (int i = 0; i < PC_N; i++) {
+		struct perf_event_attr a = {0};
+		a.type = PERF_TYPE_HARDWARE;
+		a.size = sizeof(a);
+		a.config = cfg[i];
+		a.disabled = i == 0;
+		a.exclude_kernel = 1;
+		a.exclude_hv = 1;
+		a.read_format = PERF_FORMAT_GROUP;
+		pc_fd[i] = syscall(SYS_perf_event_open, &a, 0, -1,
+			i ? pc_fd[0] : -1, 0);
+		if (pc_fd[i] < 0) {
+			while (i--)
+				close(pc_fd[i]);
+			pc_fd[0] = -1;
+			return;
+		}
+	}
+}
+
+static void perf_start(void) {
+	if (pc_fd[0] < 0) return;
+	ioctl(pc_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(pc_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void perf_stop(Counters *c) {
+	uint64_t buf[1 + PC_N];
+	c->have = false;
+	if (pc_fd[0] < 0) return;
+	ioctl(pc_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	if (read(pc_fd[0], buf, sizeof(buf)) != sizeof(buf) || buf[0] != PC_N)
+		return;
+	memcpy(c->v, buf + 1, sizeof(c->v));
+	c->have = true;
+}
+#else
+static void perf_open(void) {}
+static void perf_start(void) {}
+static void perf_stop(Counters *c) { c->have = false; }
+#endif
+
+static Glyph vm;
+
+static void setup(const Work *w, BenchIO *io) {
+	memset(&vm, 0, sizeof(vm));
+	memcpy(vm.m, w->prog, strlen(w->prog));
+	memset(io, 0, sizeof(*io));
+	io->len = w->input;
+	glyph_attach(&vm, &bench_io, io);
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static bool json;
+
+static void report(const Work *w, const Engine *e, uint64_t runes,
+    int runs, double best, const Counters *c) {
+	double ns = best * 1e9 / runes;
+	if (json) {
+		printf("{\"workload\":\"%s\",\"engine\":\"%s\",\"runes\":%llu,"
+			"\"runs\":%d,\"seconds\":%.6f,\"runes_per_s\":%.0f,"
+			"\"ns_per_rune\":%.3f", w->name, e->name,
+			(unsigned long long)runes, runs, best, runes / best, ns);
+		for (int i = 0; i < PC_N; i++)
+			if (c->have) printf(",\"%s\":%llu", pc_name[i],
+				(unsigned long long)c->v[i]);
+			else printf(",\"%s\":null", pc_name[i]);
+		printf("}\n");
+		return;
+	}
+	printf("%-8s %-9s %9.1f %8.3f", w->name, e->name, runes / best / 1e6, ns);
+	if (c->have)
+		printf(" %9.2f %9.2f %9.3f %9.3f\n",
+			(double)c->v[PC_INS] / runes, (double)c->v[PC_CYC] / runes,
+			1e3 * c->v[PC_MISS] / runes, 1e3 * c->v[PC_BMISS] / runes);
+	else
+		printf(" %9s %9s %9s %9s\n", "-", "-", "-", "-");
+}
+
+/* Returns false when an engine ends in another state than glyph_step,
+ * or the JIT runs slower than the switch it is meant to beat. */
+static bool bench(const Work *w, const char *only, int runs) {
+	BenchIO io;
+	Glyph ref;
+	double slow = 0;
+	uint32_t sum;
+	uint64_t runes = 0;
+	setup(w, &io);
+	while (!vm.halt) {
+		glyph_step(&vm);
+		runes++;
+	}
+	ref = vm;
+	sum = io.sum;
+	for (int e = 0; e < NENGINE; e++) {
+		double best = 0;
+		Counters c = {0}, cc;
+		if (only && strcmp(only, engines[e].name))
+			continue;
+		for (int i = 0; i < runs; i++) {
+			double t0, t;
+			setup(w, &io);
+			perf_start();
+			t0 = now();
+			engines[e].eval(&vm);
+			t = now() - t0;
+			perf_stop(&cc);
+			if (memcmp(vm.r, ref.r, sizeof(vm.r)) || memcmp(vm.m, ref.m,
+			    sizeof(vm.m)) || io.sum != sum) {
+				fprintf(stderr, "%s: %s ends differently from glyph_step\n",
+					w->name, engines[e].name);
+				return false;
+			}
+			if (!i || t < best) {
+				best = t;
+				c = cc;
+			}
+		}
+		report(w, &engines[e], runes, runs, best, &c);
+		if (!strcmp(engines[e].name, "switch"))
+			slow = best;
+#if defined(__x86_64__) && defined(__linux__)
+		if (!strcmp(engines[e].name, "jit") && slow && best > slow) {
+			fprintf(stderr, "%s: jit is slower than switch\n", w->name);
+			return false;
+		}
+#endif
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	const char *only = NULL;
+	int runs = 5, ok = 1, opt;
+	while ((opt = getopt(argc, argv, "jn:e:")) != -1) {
+		switch (opt) {
+		case 'j': json = true; break;
+		case 'n': runs = atoi(optarg); break;
+		case 'e': only = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-j] [-n runs] [-e engine] [workload]...\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (runs < 1) runs = 1;
+	for (size_t i = 0; i < sizeof(input); i++)
+		input[i] = 1 + i * 7 % 255;
+	if (!(jit = glyph_jit_new())) {
+		fprintf(stderr, "bench: cannot make the JIT\n");
+		return 1;
+	}
+	perf_open();
+	if (!json)
+		printf("%-8s %-9s %9s %8s %9s %9s %9s %9s\n", "workload", "engine",
+			"Mrunes/s", "ns/rune", "ins/rune", "cyc/rune", "miss/kr",
+			"bmiss/kr");
+	for (int i = 0; i < NWORK; i++) {
+		bool pick = optind == argc;
+		for (int a = optind; a < argc; a++)
+			pick |= !strcmp(argv[a], works[i].name);
+		if (pick && !bench(&works[i], only, runs))
+			ok = 0;
+	}
+	glyph_jit_free(jit);
+	return !ok;
+}
@@ -0,0 +1,241 @@
+/*
+ * fuzz - differential fuzzing of the Glyph engines
+ *
+ * An input is a void image, zero-padded to 256 bytes. glyph_step runs it
+ * for up to FUZZ_BUDGET runes; an image that halts in that time is run
+ * again on every engine: threaded, decoded, decoded in slices of
+ * glyph_step_n, the JIT and lane 0 of a batch. Each must end with the
+ * vessels, void, stack, ports, T and emits of glyph_step, and the slices
+ * must count as many runes. A mismatch prints the image and aborts, which
+ * libFuzzer and AFL record as a crash.
+ *
+ * Usage: fuzz/fuzz [-n iters] [-s seed]   random images
+ *        fuzz/fuzz file... | -             the images in files or stdin
+ *
+ * libFuzzer: clang -O1 -g -fsanitize=fuzzer,address -DGLYPH_LIBFUZZER \
+ *                fuzz/fuzz.c -o fuzz/fuzz-lf
+ * AFL:       afl-clang-fast -O2 fuzz/fuzz.c -o fuzz/fuzz-afl
+ *            afl-fuzz -i examples -o out -x fuzz/glyph.dict -- fuzz/fuzz-afl @@
+ */
+
+#define GLYPH_IMPL
+#include "../glyph.h"
+#include "../glyph_jit.h"
+#include "../glyph_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if GLYPH_BITS != 8
+#error "fuzz compares the 8-bit engines"
+#endif
+
+#define FUZZ_BUDGET 10000	/* runes glyph_step gives an image to halt */
+#define FUZZ_SLICE 7		/* glyph_step_n budget per slice */
+
+/* Hears answer from a counter, emits fold into a checksum: both are part
+ * of what the engines must agree on. */
+typedef struct {
+	uint32_t sum;
+	u8 k;
+} FuzzIO;
+
+static void io_emit(Glyph *vm, void *ctx, u8 p) {
+	FuzzIO *io = ctx;
+	io->sum = io->sum * 31 + p * 257 + vm->p[p];
+}
+
+static void io_hear(Glyph *vm, void *ctx, u8 p) {
+	FuzzIO *io = ctx;
+	vm->p[p] = io->k++ * 37 + p;
+}
+
+static GlyphDevice io_dev;
+
+static FuzzIO lane_io[GLYPH_LANES];
+
+static void lane_emit(GlyphBatch *b, int l, u8 p) {
+	lane_io[l].sum = lane_io[l].sum * 31 + p * 257 + b->p[p][l];
+}
+
+static void lane_hear(GlyphBatch *b, int l, u8 p) {
+	b->p[p][l] = lane_io[l].k++ * 37 + p;
+}
+
+static Glyph ref, vm;
+static FuzzIO ref_io, io;
+static GlyphJit *jit;
+static GlyphBatch batch;
+static u8 img[SIZE];
+static size_t img_len;
+
+/* Put img in vm and clear the state the engines compare, without
+ * zeroing the decode cache: glyph_flush marks it stale instead. */
+static void reset(Glyph *g, FuzzIO *gio) {
+	memcpy(g->m, img, SIZE);
+	memset(g->r, 0, sizeof(g->r));
+	memset(g->s, 0, sizeof(g->s));
+	memset(g->p, 0, sizeof(g->p));
+	g->T = 0;
+	g->halt = g->wait = 0;
+	g->n = 0;
+	glyph_flush(g);
+	memset(gio, 0, sizeof(*gio));
+	glyph_attach(g, &io_dev, gio);
+}
+
+static void fail(const char *engine, const char *what) {
+	fprintf(stderr, "fuzz: %s differs from glyph_step in %s on\n", engine, what);
+	for (size_t i = 0; i < img_len; i++)
+		fprintf(stderr, isprint(img[i]) && img[i] != '\\' ? "%c" : "\\x%02x", img[i]);
+	fprintf(stderr, "\n");
+	abort();
+}
+
+static void check(const char *engine) {
+	if (memcmp(vm.r, ref.r, sizeof(vm.r))) fail(engine, "vessels");
+	if (memcmp(vm.m, ref.m, sizeof(vm.m))) fail(engine, "the void");
+	if (memcmp(vm.s, ref.s, sizeof(vm.s)) || vm.T != ref.T) fail(engine, "the stack");
+	if (memcmp(vm.p, ref.p, sizeof(vm.p))) fail(engine, "ports");
+	if (io.sum != ref_io.sum || io.k != ref_io.k) fail(engine, "resonance");
+}
+
+static void check_lane(int l) {
+	for (int x = 0; x < SIZE; x++) {
+		if (batch.r[x][l] != ref.r[x]) fail("batch", "vessels");
+		if (batch.m[x][l] != ref.m[x]) fail("batch", "the void");
+		if (batch.s[x][l] != ref.s[x]) fail("batch", "the stack");
+		if (batch.p[x][l] != ref.p[x]) fail("batch", "ports");
+	}
+	if (batch.T[l] != ref.T) fail("batch", "the stack");
+	if (lane_io[l].sum != ref_io.sum || lane_io[l].k != ref_io.k)
+		fail("batch", "resonance");
+}
+
+/* Returns whether the image halted within the budget and was compared. */
+static bool fuzz_one(const u8 *data, size_t len) {
+	uint64_t runes = 0;
+	img_len = len < SIZE ? len : SIZE;
+	memset(img, 0, SIZE);
+	memcpy(img, data, img_len);
+
+	reset(&ref, &ref_io);
+	while (!ref.halt && runes < FUZZ_BUDGET) {
+		glyph_step(&ref);
+		runes++;
+	}
+	if (!ref.halt)
+		return false;
+
+	reset(&vm, &io);
+	glyph_eval_threaded(&vm);
+	check("threaded");
+
+	reset(&vm, &io);
+	glyph_eval_decoded(&vm);
+	check("decoded");
+
+	reset(&vm, &io);
+	for (uint64_t i = 0; glyph_step_n(&vm, FUZZ_SLICE) != GLYPH_HALT; i++)
+		if (i > runes)
+			fail("glyph_step_n", "halting");
+	check("glyph_step_n");
+	if (vm.n != runes)
+		fail("glyph_step_n", "the rune count");
+
+	reset(&vm, &io);
+	if (jit) glyph_jit_run(jit, &vm);
+	else glyph_eval_jit(&vm);
+	check("jit");
+
+	glyph_batch_load(&batch, img, SIZE);
+	batch.e = lane_emit;
+	batch.h = lane_hear;
+	memset(lane_io, 0, sizeof(lane_io));
+	glyph_batch_run(&batch);
+	check_lane(0);
+	check_lane(GLYPH_LANES - 1);
+	return true;
+}
+
+static void fuzz_init(void) {
+	for (int p = 0; p < SIZE; p++) {
+		io_dev.emit[p] = io_emit;
+		io_dev.hear[p] = io_hear;
+	}
+	jit = glyph_jit_new();
+}
+
+#ifdef GLYPH_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	static bool ready;
+	if (!ready) {
+		fuzz_init();
+		ready = true;
+	}
+	fuzz_one(data, size);
+	return 0;
+}
+#else
+static uint64_t seed;
+
+static uint32_t rnd(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed >> 32;
+}
+
+/* Mostly runes and vessel names, sometimes any byte; zeros after. */
+static size_t random_image(u8 *out) {
+	static const char alpha[] = "0123456789=' +-*/%&|^<>~@#?:;.,abcxyz`\n";
+	size_t len = rnd() % 64 + 1;
+	for (size_t i = 0; i < SIZE; i++) {
+		if (i < len)
+			out[i] = rnd() % 16 ? (u8)alpha[rnd() % (sizeof(alpha) - 1)] : (u8)rnd();
+		else
+			out[i] = rnd() % 8 ? 0 : rnd();
+	}
+	return SIZE;
+}
+
+int main(int argc, char **argv) {
+	long iters = 100000, halted = 0, runs = 0;
+	u8 buf[SIZE];
+	int i = 1;
+	double t0;
+	seed = 0x9e3779b97f4a7c15ull;
+	for (; i + 1 < argc && argv[i][0] == '-' && argv[i][1]; i += 2) {
+		if (!strcmp(argv[i], "-n"))
+			iters = atol(argv[i + 1]);
+		else if (!strcmp(argv[i], "-s"))
+			seed ^= strtoull(argv[i + 1], NULL, 0) * 0x2545f4914f6cdd1dull;
+		else
+			break;
+	}
+	if (i < argc && argv[i][0] == '-' && argv[i][1]) {
+		fprintf(stderr, "Usage: %s [-n iters] [-s seed] | file... | -\n", argv[0]);
+		return 1;
+	}
+	fuzz_init();
+	t0 = clock() / (double)CLOCKS_PER_SEC;
+	if (i < argc) {
+		for (; i < argc; i++, runs++) {
+			FILE *f = strcmp(argv[i], "-") ? fopen(argv[i], "rb") : stdin;
+			if (!f) {
+				fprintf(stderr, "fuzz: cannot open '%s'\n", argv[i]);
+				return 1;
+			}
+			halted += fuzz_one(buf, fread(buf, 1, SIZE, f));
+			if (f != stdin) fclose(f);
+		}
+	} else {
+		for (; runs < iters; runs++)
+			halted += fuzz_one(buf, random_image(buf));
+	}
+	double t = clock() / (double)CLOCKS_PER_SEC - t0;
+	printf("%ld images, %ld halted and matched, %.0f execs/s\n", runs, halted,
+		t > 0 ? runs / t : 0);
+	return 0;
+}
+#endif
@@ -1,5 +1,11 @@
-/* GLYPH - Single-header character-based VM (~200 lines)
+/* GLYPH - Single-header character-based VM
  * Usage: #define GLYPH_IMPL before including in ONE .c file
+ *
+ * glyph_step is the reference semantics; the switch, threaded and decoded
+ * engines run the same runes faster, glyph_step_n runs in slices, and
+ * snapshot images, profiling and tracing builds sit alongside. The JIT,
+ * batch, scheduler, loader, replay and memory device are the glyph_*.h
+ * headers next to this one.
  */
 #ifndef GLYPH_H
 #define GLYPH_H
@@ -13,30 +19,158 @@
 typedef uint8_t  u8;
 #define SIZE 0x100
 
-/* Resonance */
-typedef void (*R)(u8 p);
+/* Vessel width. 8 is the classic VM: a 256-byte void inside Glyph and every
+ * engine. 16 and 32 widen vessels, stack and ports to GlyphWord and let the
+ * void be any power-of-two buffer handed to glyph_init; those builds run
+ * every engine on the switch. */
+#ifndef GLYPH_BITS
+#define GLYPH_BITS 8
+#endif
+#if GLYPH_BITS == 8
+typedef uint8_t  GlyphWord;
+#elif GLYPH_BITS == 16
+typedef uint16_t GlyphWord;
+#elif GLYPH_BITS == 32
+typedef uint32_t GlyphWord;
+#else
+#error "GLYPH_BITS must be 8, 16 or 32"
+#endif
 
+typedef struct Glyph Glyph;
+
+/* Resonance: called with the VM that rang port p */
+typedef void (*R)(Glyph *vm, u8 p);
+
+/* Device: a handler per port, passed the context of the VM it serves.
+ * One table can back any number of VMs. */
+typedef void (*GlyphPort)(Glyph *vm, void *ctx, u8 p);
+typedef struct {
+	GlyphPort emit[SIZE], hear[SIZE];
+} GlyphDevice;
+
+/* Decoded rune: kind, byte length, operand vessels, a folded decimal
+ * immediate (acc = acc * mul + add) and the number of runes it stands
+ * for. k == 0 marks the entry dirty. */
+typedef struct {
+	u8 k, len, a, b, mul, add, c;
+} GlyphOp;
+
+#ifdef GLYPH_PROFILE
+/* Counts kept by glyph_step in a profiling build. Wide voids count only
+ * their first SIZE addresses. */
+typedef struct {
+	uint64_t rune[SIZE];		/* by rune byte */
+	uint64_t at[SIZE];		/* by address */
+	uint64_t call[SIZE];		/* by ';' target */
+	uint64_t in[SIZE], out[SIZE];	/* by port */
+} GlyphProfile;
+#endif
+
+#ifdef GLYPH_TRACE
+#include <stdatomic.h>
+#include <stdlib.h>
+/* Ring of the last GLYPH_TRACE_SIZE runes run, in a tracing build: each
+ * record is the state a rune started from. */
+#ifndef GLYPH_TRACE_SIZE
+#define GLYPH_TRACE_SIZE 4096	/* records, a power of two */
+#endif
 typedef struct {
-	u8 m[SIZE], r[SIZE], s[SIZE], p[SIZE];
+	GlyphWord pc, acc, flg;
+	u8 op, T;
+} GlyphTraceRec;
+#endif
+
+/* Longest decoded rune, fused runs included; a write to m[x] dirties
+ * d[x - GLYPH_SPAN + 1 .. x]. */
+#define GLYPH_SPAN 8
+/* Longest digit run folded into one immediate. */
+#define GLYPH_DIGITS 3
+
+struct Glyph {
+#if GLYPH_BITS == 8
+	u8 m[SIZE];
+#else
+	u8 *m;
+	uint32_t mask;	/* void size - 1 */
+	u8 *map;	/* a void glyph_load mapped, until glyph_unload */
+	uint32_t map_size;
+#endif
+	GlyphWord r[SIZE], s[SIZE], p[SIZE];
 	u8 T;
 	R e, h;
+	const GlyphDevice *dev;
+	void *ctx;
 	bool halt;
-} Glyph;
+	bool wait;	/* set by h: no input yet, rerun the '#<' later */
+	uint64_t n;	/* runes run under glyph_step_n */
+#if GLYPH_BITS == 8
+	GlyphOp d[SIZE];
+	/* Bytes under translated code (glyph_jit.h); a poke there bumps gen
+	 * and widens tlo..thi, the bytes written since the JIT last looked. */
+	u8 tm[SIZE / 8];
+	unsigned gen;
+	u8 tlo, thi;
+#endif
+#ifdef GLYPH_PROFILE
+	GlyphProfile prof;
+#endif
+#ifdef GLYPH_TRACE
+	GlyphTraceRec trace[GLYPH_TRACE_SIZE];
+	_Atomic uint64_t tn;	/* records written; the newest is tn - 1 */
+#endif
+};
 
-void glyph_read(Glyph *vm, char *book);
+/* Program loading; files and fds are in glyph_load.h */
+bool glyph_read(Glyph *vm, const void *book, size_t len);
 void glyph_eval(Glyph *vm);
+void glyph_eval_switch(Glyph *vm);
+void glyph_eval_threaded(Glyph *vm);
+void glyph_eval_decoded(Glyph *vm);
+void glyph_eval_jit(Glyph *vm); /* glyph_jit.h */
+void glyph_decode(Glyph *vm, u8 x);
+void glyph_poke(Glyph *vm, GlyphWord x, u8 v);
+void glyph_dirty(Glyph *vm, GlyphWord x, uint32_t n);
+
+/* glyph_step_n results */
+enum { GLYPH_HALT, GLYPH_BUDGET, GLYPH_WAIT };
+int glyph_step_n(Glyph *vm, uint64_t budget);
+void glyph_flush(Glyph *vm);
+void glyph_attach(Glyph *vm, const GlyphDevice *dev, void *ctx);
+#if GLYPH_BITS > 8
+void glyph_init(Glyph *vm, u8 *mem, uint32_t size);
+#endif
+
+/* Snapshot image: "GLYF", version, GLYPH_BITS, halt, T, n (8 bytes), void
+ * size (4), then r, s and p as little-endian words, then the void. Host
+ * state (callbacks, device, context, caches) is not in it. */
+#define GLYPH_IMAGE_VERSION 1
+#define GLYPH_IMAGE_HEAD 20
+size_t glyph_image_size(const Glyph *vm);
+size_t glyph_snapshot(const Glyph *vm, u8 *buf, size_t cap);
+bool glyph_restore(Glyph *vm, const u8 *img, size_t len);
+#if GLYPH_BITS > 8
+bool glyph_adopt(Glyph *vm, u8 *img, size_t len);
+#endif
+
+#ifdef GLYPH_TRACE
+/* Trace file: "GLYT", version, GLYPH_BITS, 2 zero bytes, records ever
+ * written (8 bytes), records kept (4), then each kept record oldest
+ * first as little-endian pc, acc, flg words, op and T. */
+#define GLYPH_TRACE_VERSION 1
+bool glyph_trace_write(Glyph *vm, FILE *f);
+#endif
 
 /* ────────────────────────────────────────────────────────────────────────── */
 #ifdef GLYPH_IMPL
 
-static inline u8 glyph_getr(Glyph *vm, u8 reg) {
+static inline GlyphWord glyph_getr(Glyph *vm, u8 reg) {
 	if (reg == ',') {
 		return vm->s[--vm->T];
 	}
 	return vm->r[reg];
 }
 
-static inline void glyph_setr(Glyph *vm, u8 reg, u8 val) {
+static inline void glyph_setr(Glyph *vm, u8 reg, GlyphWord val) {
 	if (reg == ',') {
 		vm->s[vm->T++] = val;
 		return;
@@ -44,90 +178,883 @@ static inline void glyph_setr(Glyph *vm, u8 reg, u8 val) {
 	vm->r[reg] = val;
 }
 
+/* Address x in the void. Wide voids wrap at their size; '.' itself is
+ * left unmasked and wraps only on use. */
+#if GLYPH_BITS == 8
+#define GLYPH_AT(x) ((u8)(x))
+#else
+#define GLYPH_AT(x) ((x) & vm->mask)
+#endif
+
 static inline u8 glyph_next(Glyph *vm) {
-	u8 pc = glyph_getr(vm, '.');
-	u8 res = vm->m[pc++];
-	glyph_setr(vm, '.', pc);
+	GlyphWord pc = glyph_getr(vm, '.');
+	u8 res = vm->m[GLYPH_AT(pc)];
+	glyph_setr(vm, '.', pc + 1);
 	return res;
 }
 
+#if GLYPH_BITS == 8
+/* Every write to the void goes through here so decoded runes that cover
+ * x are re-read. Hosts that write vm->m directly call glyph_dirty on what
+ * they wrote, or glyph_flush. */
+void glyph_poke(Glyph *vm, GlyphWord x, u8 v) {
+	vm->m[x] = v;
+	for (int i = 0; i < GLYPH_SPAN; i++)
+		vm->d[(u8)(x - i)].k = 0;
+	if (vm->tm[x >> 3] >> (x & 7) & 1) {
+		vm->gen++;
+		if (x < vm->tlo) vm->tlo = x;
+		if (x > vm->thi) vm->thi = x;
+	}
+}
+
+/* As n pokes from x: the bytes are already in vm->m. */
+void glyph_dirty(Glyph *vm, GlyphWord x, uint32_t n) {
+	bool tm = false;
+	if (n >= SIZE) {
+		glyph_flush(vm);
+		return;
+	}
+	for (uint32_t i = 0; n && i < n + GLYPH_SPAN - 1; i++)
+		vm->d[(u8)(x + n - 1 - i)].k = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		u8 y = x + i;
+		if (!(vm->tm[y >> 3] >> (y & 7) & 1)) continue;
+		tm = true;
+		if (y < vm->tlo) vm->tlo = y;
+		if (y > vm->thi) vm->thi = y;
+	}
+	if (tm)
+		vm->gen++;
+}
+
+void glyph_flush(Glyph *vm) {
+	for (int i = 0; i < SIZE; i++)
+		vm->d[i].k = 0;
+	vm->gen++;
+	vm->tlo = 0;
+	vm->thi = SIZE - 1;
+}
+#else
+void glyph_poke(Glyph *vm, GlyphWord x, u8 v) {
+	vm->m[GLYPH_AT(x)] = v;
+}
+
+void glyph_dirty(Glyph *vm, GlyphWord x, uint32_t n) {
+	(void)vm; (void)x; (void)n;
+}
+
+void glyph_flush(Glyph *vm) {
+	(void)vm;
+}
+
+/* Clear vm and give it the void mem; only the largest power of two that
+ * fits in size is used. */
+void glyph_init(Glyph *vm, u8 *mem, uint32_t size) {
+	uint32_t n = 1;
+	memset(vm, 0, sizeof(*vm));
+	while (n <= size / 2)
+		n *= 2;
+	vm->m = mem;
+	vm->mask = size ? n - 1 : 0;
+}
+#endif
+
+static void glyph_dev_emit(Glyph *vm, u8 p) {
+	GlyphPort f = vm->dev->emit[p];
+	if (f) f(vm, vm->ctx, p);
+}
+
+static void glyph_dev_hear(Glyph *vm, u8 p) {
+	GlyphPort f = vm->dev->hear[p];
+	if (f) f(vm, vm->ctx, p);
+}
+
+/* Route vm's resonance through dev with ctx; ports without a handler
+ * stay silent. */
+void glyph_attach(Glyph *vm, const GlyphDevice *dev, void *ctx) {
+	vm->dev = dev;
+	vm->ctx = ctx;
+	vm->e = glyph_dev_emit;
+	vm->h = glyph_dev_hear;
+}
+
+#if GLYPH_BITS == 8
+#define GLYPH_VOID(vm) ((void)(vm), (uint32_t)SIZE)
+#else
+#define GLYPH_VOID(vm) ((vm)->mask + 1)
+#endif
+#define GLYPH_WORDS (3 * SIZE * (GLYPH_BITS / 8))
+
+size_t glyph_image_size(const Glyph *vm) {
+	return GLYPH_IMAGE_HEAD + GLYPH_WORDS + GLYPH_VOID(vm);
+}
+
+/* Put the len bytes of book at the start of the void, past what the
+ * caches hold; false if they do not fit. The rest of the void is kept. */
+bool glyph_read(Glyph *vm, const void *book, size_t len) {
+	if (len > GLYPH_VOID(vm))
+		return false;
+	memcpy(vm->m, book, len);
+	glyph_flush(vm);
+	return true;
+}
+
+static u8 *glyph_le_put(u8 *o, uint64_t v, int n) {
+	for (int i = 0; i < n; i++, v >>= 8)
+		*o++ = (u8)v;
+	return o;
+}
+
+static uint64_t glyph_le_get(const u8 **in, int n) {
+	uint64_t v = 0;
+	for (int i = n; i--;)
+		v = v << 8 | (*in)[i];
+	*in += n;
+	return v;
+}
+
+/* Write vm's image to buf; 0 if it needs more than cap bytes. */
+size_t glyph_snapshot(const Glyph *vm, u8 *buf, size_t cap) {
+	size_t len = glyph_image_size(vm);
+	const GlyphWord *w[3] = { vm->r, vm->s, vm->p };
+	u8 *o = buf;
+	if (cap < len)
+		return 0;
+	memcpy(o, "GLYF", 4);
+	o[4] = GLYPH_IMAGE_VERSION;
+	o[5] = GLYPH_BITS;
+	o[6] = vm->halt;
+	o[7] = vm->T;
+	o = glyph_le_put(o + 8, vm->n, 8);
+	o = glyph_le_put(o, GLYPH_VOID(vm), 4);
+	for (int k = 0; k < 3; k++)
+		for (int i = 0; i < SIZE; i++)
+			o = glyph_le_put(o, w[k][i], GLYPH_BITS / 8);
+	memcpy(o, vm->m, GLYPH_VOID(vm));
+	return len;
+}
+
+/* Check img and load everything but the void into vm; returns the void
+ * size, or 0 if img is not a whole image of this build (with a void of
+ * want bytes, unless want is 0). */
+static uint32_t glyph_image_load(Glyph *vm, const u8 *img, size_t len,
+    uint32_t want) {
+	GlyphWord *w[3] = { vm->r, vm->s, vm->p };
+	const u8 *in = img + 8;
+	uint64_t n;
+	uint32_t size;
+	if (len < GLYPH_IMAGE_HEAD || memcmp(img, "GLYF", 4) ||
+	    img[4] != GLYPH_IMAGE_VERSION || img[5] != GLYPH_BITS)
+		return 0;
+	n = glyph_le_get(&in, 8);
+	size = glyph_le_get(&in, 4);
+	if (!size || size & (size - 1) || (want && size != want) ||
+	    len != GLYPH_IMAGE_HEAD + GLYPH_WORDS + (size_t)size)
+		return 0;
+	for (int k = 0; k < 3; k++)
+		for (int i = 0; i < SIZE; i++)
+			w[k][i] = glyph_le_get(&in, GLYPH_BITS / 8);
+	vm->halt = img[6];
+	vm->T = img[7];
+	vm->n = n;
+	vm->wait = 0;
+	return size;
+}
+
+/* Load an image taken by glyph_snapshot into vm, keeping its callbacks,
+ * device and context. The void sizes must match. */
+bool glyph_restore(Glyph *vm, const u8 *img, size_t len) {
+	if (!glyph_image_load(vm, img, len, GLYPH_VOID(vm)))
+		return false;
+	memcpy(vm->m, img + GLYPH_IMAGE_HEAD + GLYPH_WORDS, GLYPH_VOID(vm));
+	glyph_flush(vm);
+	return true;
+}
+
+#if GLYPH_BITS > 8
+/* Like glyph_restore, but vm takes the void inside img as its own, of
+ * whatever size; img must outlive vm. Mapping the image MAP_PRIVATE
+ * gives each VM copy-on-write pages of a shared file. */
+bool glyph_adopt(Glyph *vm, u8 *img, size_t len) {
+	uint32_t size = glyph_image_load(vm, img, len, 0);
+	if (!size)
+		return false;
+	vm->m = img + GLYPH_IMAGE_HEAD + GLYPH_WORDS;
+	vm->mask = size - 1;
+	return true;
+}
+#endif
+
+#ifdef GLYPH_TRACE
+/* May run on another thread while vm runs: records the VM laps during
+ * the copy are left out, and so is the oldest slot, which is the next
+ * one written. */
+bool glyph_trace_write(Glyph *vm, FILE *f) {
+	GlyphTraceRec *t = malloc(sizeof(vm->trace));
+	u8 head[20] = "GLYT", rec[3 * sizeof(GlyphWord) + 2], *o;
+	uint64_t n0, n1, first;
+	bool ok;
+	if (!t) return false;
+	n0 = atomic_load_explicit(&vm->tn, memory_order_acquire);
+	memcpy(t, vm->trace, sizeof(vm->trace));
+	atomic_thread_fence(memory_order_acquire);
+	n1 = atomic_load_explicit(&vm->tn, memory_order_relaxed);
+	first = n0 > GLYPH_TRACE_SIZE ? n0 - GLYPH_TRACE_SIZE : 0;
+	if (n1 >= GLYPH_TRACE_SIZE && first <= n1 - GLYPH_TRACE_SIZE)
+		first = n1 - GLYPH_TRACE_SIZE + 1;
+	if (first > n0)
+		first = n0;
+	head[4] = GLYPH_TRACE_VERSION;
+	head[5] = GLYPH_BITS;
+	o = glyph_le_put(head + 8, n0, 8);
+	glyph_le_put(o, n0 - first, 4);
+	ok = fwrite(head, 1, sizeof(head), f) == sizeof(head);
+	for (uint64_t i = first; ok && i < n0; i++) {
+		GlyphTraceRec *r = &t[i & (GLYPH_TRACE_SIZE - 1)];
+		o = glyph_le_put(rec, r->pc, sizeof(GlyphWord));
+		o = glyph_le_put(o, r->acc, sizeof(GlyphWord));
+		o = glyph_le_put(o, r->flg, sizeof(GlyphWord));
+		o[0] = r->op;
+		o[1] = r->T;
+		ok = fwrite(rec, 1, sizeof(rec), f) == sizeof(rec);
+	}
+	free(t);
+	return ok;
+}
+#endif
+
 #define R(x) glyph_getr(vm, (x))
 #define WR(x, v) glyph_setr(vm, (x), (v))
-#define M(x) vm->m[(x)]
-#define P(x) vm->p[(x)]
+#define M(x) vm->m[GLYPH_AT(x)]
+#define P(x) vm->p[(u8)(x)]
 #define ACC(x) glyph_setr(vm, '=', (x))
 #define FLG(x) glyph_setr(vm, '?', (x))
 #define A R('=')
 #define N  glyph_next(vm)
+#ifdef GLYPH_PROFILE
+#define PROF(f, x) do { uint32_t x_ = (x); \
+	if (x_ < SIZE) vm->prof.f[x_]++; } while (0)
+#else
+#define PROF(f, x) ((void)0)
+#endif
+#ifdef GLYPH_TRACE
+/* One writer, the thread running vm, with its count of records in n;
+ * the release store of tn publishes the record to readers elsewhere. The
+ * fence after it keeps the next record from landing before the count
+ * does, as a seqlock writer would: a reader that saw a slot overwritten
+ * then sees a count that leaves the slot out. Free on x86. */
+#define TRACE_N(n, pc_, op_, acc_, flg_) do { \
+	vm->trace[(n) & (GLYPH_TRACE_SIZE - 1)] = \
+		(GlyphTraceRec){ (pc_), (acc_), (flg_), (op_), vm->T }; \
+	atomic_store_explicit(&vm->tn, ++(n), memory_order_release); \
+	atomic_thread_fence(memory_order_release); \
+} while (0)
+#define TRACE(pc_, op_, acc_, flg_) do { \
+	uint64_t n_ = atomic_load_explicit(&vm->tn, memory_order_relaxed); \
+	TRACE_N(n_, pc_, op_, acc_, flg_); \
+} while (0)
 
-void glyph_eval(Glyph *vm) {
-	u8 op, a, b;
-	while (!vm->halt) {
-		op = N;
-//		printf("op: %c pc: %d acc: %d flg: %d\n", op, R('.'), A, R('?'));
-		if (vm->halt) break;
-		switch (op) {
-		/* NooP */
-		case' ':case'\f':case'\n':case'\v':case'\r':case'\t':
-			ACC(0); break; /* NesCafe Aproved */
-		/*IMM*/
-		case'0':case'1':case'2':case'3':case'4':
-		case'5':case'6':case'7':case'8':case'9':
-			ACC((A * 10) + (op - '0')); break;
-		case '=': WR(N, A); ACC(0); break;
-		case '\'': ACC(N); break;
-		/* Arithmetic: +abc -abc *abc /abc %abc */
-		case '+': a=R(N);b=R(N); ACC(a + b); break;
-		case '-': a=R(N);b=R(N); ACC(a - b); break;
-		case '*': a=R(N);b=R(N); ACC(a * b); break;
-		case '/': a=R(N);b=R(N); ACC(b ? a / b : 0); break;
-		case '%': a=R(N);b=R(N); ACC(b ? a % b : 0); break;
-		/* Bitwise: &abc |abc ^abc ~ab <bc >abc */
-		case '&': a=R(N);b=R(N); ACC(a & b); break;
-		case '|': a=R(N);b=R(N); ACC(a | b); break;
-		case '^': a=R(N);b=R(N); ACC(a ^ b); break;
-		case '<': a=R(N); ACC(a << A); break;
-		case '>': a=R(N); ACC(a >> A); break;
-		case '~': a=R(N); ACC(~a); break;
-		/* Memory: @<a @>a */
-		case '@': { a=N;b=N;
-			switch (a) {
-			case '<': WR(b, M(A)); break;
-			case '>': M(A) = R(b); break;
-			}
-		} break;
-		/* Ports: #<a #>a (resonance) */
-		case '#': { a=N;b=N;
-			switch (a) {
-			case '<': if (vm->h) vm->h(A); WR(b, P(A)); break;
-			case '>': P(A) = R(b); if (vm->e) vm->e(A); break;
-			}
-		} break;
-		/* Compare: ?=a ?!a ?<a ?>a */
-		case '?': { a=N;b=N;
-			switch (a) {
-			case '=': FLG(A == R(b)); break;
-			case '!': FLG(A != R(b)); break;
-			case '<': FLG(A <  R(b)); break;
-			case '>': FLG(A >  R(b)); break;
-			}
-		} break;
-		/* Conditional Move: :a (if ? is true move from acc to a) */
-		case ':': if (R('?')) WR(N, A); ACC(0); break;
-		/* Call: ;a */
-		case ';': vm->s[vm->T++] = R('.'); WR('.', R(N)); break;
-		case '`': case 0: vm->halt = 1; break;
-		default: a=N; WR(a, R(op)); break;
+/* Record the rune at '.' from vm->r, for engines that keep it current
+ * there (glyph_jit.h, at each block entry). */
+static inline void glyph_trace_here(Glyph *vm) {
+	GlyphWord pc = R('.');
+	TRACE(pc, M(pc), A, R('?'));
+}
+#else
+#define TRACE_N(n, pc_, op_, acc_, flg_) ((void)0)
+#define TRACE(pc_, op_, acc_, flg_) ((void)0)
+#endif
+
+/* Execute the single rune at '.'; the reference semantics. */
+static inline void glyph_step(Glyph *vm) {
+	u8 op;
+	GlyphWord a, b;
+	PROF(at, GLYPH_AT(vm->r['.']));
+	op = N;
+	PROF(rune, op);
+	TRACE(R('.') - 1, op, A, R('?'));
+//	printf("op: %c pc: %d acc: %d flg: %d\n", op, R('.'), A, R('?'));
+	switch (op) {
+	/* NooP */
+	case' ':case'\f':case'\n':case'\v':case'\r':case'\t':
+		ACC(0); break; /* NesCafe Aproved */
+	/*IMM*/
+	case'0':case'1':case'2':case'3':case'4':
+	case'5':case'6':case'7':case'8':case'9':
+		ACC((A * 10) + (op - '0')); break;
+	case '=': WR(N, A); ACC(0); break;
+	case '\'': ACC(N); break;
+	/* Arithmetic: +abc -abc *abc /abc %abc */
+	case '+': a=R(N);b=R(N); ACC(a + b); break;
+	case '-': a=R(N);b=R(N); ACC(a - b); break;
+	case '*': a=R(N);b=R(N); ACC(a * b); break;
+	case '/': a=R(N);b=R(N); ACC(b ? a / b : 0); break;
+	case '%': a=R(N);b=R(N); ACC(b ? a % b : 0); break;
+	/* Bitwise: &abc |abc ^abc ~ab <bc >abc */
+	case '&': a=R(N);b=R(N); ACC(a & b); break;
+	case '|': a=R(N);b=R(N); ACC(a | b); break;
+	case '^': a=R(N);b=R(N); ACC(a ^ b); break;
+	case '<': a=R(N); ACC(A >= GLYPH_BITS ? 0 : a << A); break;
+	case '>': a=R(N); ACC(A >= GLYPH_BITS ? 0 : a >> A); break;
+	case '~': a=R(N); ACC(~a); break;
+	/* Memory: @<a @>a */
+	case '@': { a=N;b=N;
+		switch (a) {
+		case '<': WR(b, M(A)); break;
+		case '>': glyph_poke(vm, A, R(b)); break;
+		}
+	} break;
+	/* Ports: #<a #>a (resonance) */
+	case '#': { a=N;b=N;
+		switch (a) {
+		case '<': PROF(in, (u8)A);
+			if (vm->h) vm->h(vm, (u8)A);
+			if (vm->wait) { WR('.', R('.') - 3); break; }
+			WR(b, P(A)); break;
+		case '>': PROF(out, (u8)A);
+			P(A) = R(b); if (vm->e) vm->e(vm, (u8)A); break;
+		}
+	} break;
+	/* Compare: ?=a ?!a ?<a ?>a */
+	case '?': { a=N;b=N;
+		switch (a) {
+		case '=': FLG(A == R(b)); break;
+		case '!': FLG(A != R(b)); break;
+		case '<': FLG(A <  R(b)); break;
+		case '>': FLG(A >  R(b)); break;
+		}
+	} break;
+	/* Conditional Move: :a (if ? is true move from acc to a) */
+	case ':': if (R('?')) WR(N, A); ACC(0); break;
+	/* Call: ;a */
+	case ';': vm->s[vm->T++] = R('.'); WR('.', R(N));
+		PROF(call, R('.')); break;
+	case '`': case 0: vm->halt = 1; break;
+	default: a=N; WR(a, R(op)); break;
+	}
+}
+
+void glyph_eval_switch(Glyph *vm) {
+	vm->wait = 0;
+	while (!vm->halt && !vm->wait)
+		glyph_step(vm);
+}
+
+#if GLYPH_BITS == 8
+/* Rune classes, shared by the engines that dispatch through a table. */
+enum {
+	GK_CPY, GK_NOP, GK_DIG, GK_STO, GK_LIT, GK_ADD, GK_SUB, GK_MUL,
+	GK_DIV, GK_MOD, GK_AND, GK_OR,  GK_XOR, GK_SHL, GK_SHR, GK_NOT,
+	GK_MEM, GK_PRT, GK_CMP, GK_CMV, GK_CAL, GK_HLT, GK_N
+};
+
+static const u8 glyph_cls[SIZE] = {
+	[' ']=GK_NOP, ['\f']=GK_NOP, ['\n']=GK_NOP, ['\v']=GK_NOP,
+	['\r']=GK_NOP, ['\t']=GK_NOP,
+	['0']=GK_DIG, ['1']=GK_DIG, ['2']=GK_DIG, ['3']=GK_DIG, ['4']=GK_DIG,
+	['5']=GK_DIG, ['6']=GK_DIG, ['7']=GK_DIG, ['8']=GK_DIG, ['9']=GK_DIG,
+	['=']=GK_STO, ['\'']=GK_LIT,
+	['+']=GK_ADD, ['-']=GK_SUB, ['*']=GK_MUL, ['/']=GK_DIV, ['%']=GK_MOD,
+	['&']=GK_AND, ['|']=GK_OR,  ['^']=GK_XOR,
+	['<']=GK_SHL, ['>']=GK_SHR, ['~']=GK_NOT,
+	['@']=GK_MEM, ['#']=GK_PRT, ['?']=GK_CMP, [':']=GK_CMV, [';']=GK_CAL,
+	['`']=GK_HLT, [0]=GK_HLT,
+};
+
+/* Engines that cache pc, '=' and '?' in locals read and write vessels
+ * through these; vm->r is only current after TSYNC. */
+#define TR(x) ((x) == '.' ? pc : (x) == '=' ? acc : (x) == '?' ? flg : \
+	glyph_getr(vm, (x)))
+#define TW(x, v) do { u8 r_ = (x), v_ = (v); \
+	if (r_ == '.') pc = v_; else if (r_ == '=') acc = v_; \
+	else if (r_ == '?') flg = v_; else glyph_setr(vm, r_, v_); } while (0)
+#define TSYNC() (vm->r['.'] = pc, vm->r['='] = acc, vm->r['?'] = flg)
+#define TLOAD() (pc = vm->r['.'], acc = vm->r['='], flg = vm->r['?'])
+
+#if defined(__GNUC__)
+/* Direct-threaded engine: every handler jumps straight to the next one.
+ * pc, '=' and '?' live in locals and are written back to vm->r only
+ * around resonance and on halt. */
+#define TN vm->m[pc++]
+#define NEXT do { op = TN; TRACE_N(tn, pc - 1, op, acc, flg); \
+	goto *lab[glyph_cls[op]]; } while (0)
+
+void glyph_eval_threaded(Glyph *vm) {
+	static void *const lab[GK_N] = {
+		[GK_CPY]=&&cpy, [GK_NOP]=&&nop, [GK_DIG]=&&dig, [GK_STO]=&&sto,
+		[GK_LIT]=&&lit, [GK_ADD]=&&add, [GK_SUB]=&&sub, [GK_MUL]=&&mul,
+		[GK_DIV]=&&dvd, [GK_MOD]=&&mod, [GK_AND]=&&and, [GK_OR]=&&or,
+		[GK_XOR]=&&xor, [GK_SHL]=&&shl, [GK_SHR]=&&shr, [GK_NOT]=&&not,
+		[GK_MEM]=&&mem, [GK_PRT]=&&prt, [GK_CMP]=&&cmp, [GK_CMV]=&&cmv,
+		[GK_CAL]=&&cal, [GK_HLT]=&&hlt,
+	};
+	u8 pc, acc, flg, op, a, b;
+#ifdef GLYPH_TRACE
+	uint64_t tn = atomic_load_explicit(&vm->tn, memory_order_relaxed);
+#endif
+	vm->wait = 0;
+	if (vm->halt) return;
+	TLOAD();
+	NEXT;
+nop:	acc = 0; NEXT;
+dig:	acc = acc * 10 + (op - '0'); NEXT;
+sto:	a = TN; TW(a, acc); acc = 0; NEXT;
+lit:	acc = TN; NEXT;
+add:	a = TN; a = TR(a); b = TN; b = TR(b); acc = a + b; NEXT;
+sub:	a = TN; a = TR(a); b = TN; b = TR(b); acc = a - b; NEXT;
+mul:	a = TN; a = TR(a); b = TN; b = TR(b); acc = a * b; NEXT;
+dvd:	a = TN; a = TR(a); b = TN; b = TR(b); acc = b ? a / b : 0; NEXT;
+mod:	a = TN; a = TR(a); b = TN; b = TR(b); acc = b ? a % b : 0; NEXT;
+and:	a = TN; a = TR(a); b = TN; b = TR(b); acc = a & b; NEXT;
+or:	a = TN; a = TR(a); b = TN; b = TR(b); acc = a | b; NEXT;
+xor:	a = TN; a = TR(a); b = TN; b = TR(b); acc = a ^ b; NEXT;
+shl:	a = TN; a = TR(a); acc = acc > 7 ? 0 : a << acc; NEXT;
+shr:	a = TN; a = TR(a); acc = acc > 7 ? 0 : a >> acc; NEXT;
+not:	a = TN; a = TR(a); acc = ~a; NEXT;
+mem:	a = TN; b = TN;
+	if (a == '<') TW(b, vm->m[acc]);
+	else if (a == '>') glyph_poke(vm, acc, TR(b));
+	NEXT;
+prt:	a = TN; b = TN;
+	if (a == '<') {
+		TSYNC(); if (vm->h) vm->h(vm, acc); TLOAD();
+		if (vm->wait) { pc -= 3; goto out; }
+		TW(b, vm->p[acc]);
+	} else if (a == '>') {
+		vm->p[acc] = TR(b);
+		TSYNC(); if (vm->e) vm->e(vm, acc); TLOAD();
+	}
+	if (vm->halt) goto out;
+	NEXT;
+cmp:	a = TN; b = TN;
+	switch (a) {
+	case '=': flg = acc == TR(b); break;
+	case '!': flg = acc != TR(b); break;
+	case '<': flg = acc <  TR(b); break;
+	case '>': flg = acc >  TR(b); break;
+	}
+	NEXT;
+cmv:	if (flg) { a = TN; TW(a, acc); } acc = 0; NEXT;
+cal:	vm->s[vm->T++] = pc; a = TN; pc = TR(a); NEXT;
+cpy:	a = TN; b = TR(op); TW(a, b); NEXT;
+hlt:	vm->halt = 1;
+out:	TSYNC();
+}
+
+#undef TN
+#undef NEXT
+#else
+void glyph_eval_threaded(Glyph *vm) { glyph_eval_switch(vm); }
+#endif
+
+/* Decoded kinds. GD_DTY is a dirty entry. Operands are resolved so the
+ * handlers index vm->r directly: '.' and '=' as destinations get their
+ * own kinds, and any other rune naming '.', '=', '?' or ',' decodes as
+ * GD_SLW and is handed to glyph_step. Kinds after GD_HLT are fused
+ * sequences, picked from tools/ngram counts over the examples:
+ *   IMS  NN=x       IMJ  NN=.       LTS  'c=x       LTO  'c#>x
+ *   Ixx  NN?=x      Bxx  ?=x NN:.   CLD  s=@<x      CJR  L=:.
+ * A blank in front of a rune that does not read '=' folds into it. */
+enum {
+	GD_DTY, GD_SLW, GD_NOP, GD_IMM, GD_STO, GD_JMP, GD_LIT, GD_ADD,
+	GD_SUB, GD_MUL, GD_DIV, GD_MOD, GD_AND, GD_OR,  GD_XOR, GD_SHL,
+	GD_SHR, GD_NOT, GD_MLD, GD_MST, GD_PIN, GD_POU, GD_CEQ, GD_CNE,
+	GD_CLT, GD_CGT, GD_CMV, GD_CJP, GD_CAL, GD_CPY, GD_CPA, GD_JPR,
+	GD_LBL, GD_SKP, GD_HLT,
+	GD_IMS, GD_IMJ, GD_LTS, GD_LTO, GD_IEQ, GD_INE, GD_ILT, GD_IGT,
+	GD_BEQ, GD_BNE, GD_BLT, GD_BGT, GD_CLD, GD_CJR, GD_N
+};
+
+static inline bool glyph_special(u8 reg) {
+	return reg == '.' || reg == '=' || reg == '?' || reg == ',';
+}
+
+/* Decode the single rune at x into *d, without fusion. */
+static void glyph_decode_rune(Glyph *vm, u8 x, GlyphOp *d) {
+	u8 op = vm->m[x], a = vm->m[(u8)(x + 1)], b = vm->m[(u8)(x + 2)];
+	bool ra = glyph_special(a), rb = glyph_special(b);
+	d->a = a; d->b = b; d->len = 1; d->c = 1;
+	switch (glyph_cls[op]) {
+	case GK_NOP: d->k = GD_NOP; break;
+	case GK_DIG:
+		d->k = GD_IMM; d->mul = 1; d->add = 0; d->len = 0;
+		while (d->len < GLYPH_DIGITS) {
+			op = vm->m[(u8)(x + d->len)];
+			if (glyph_cls[op] != GK_DIG) break;
+			d->mul *= 10; d->add = d->add * 10 + (op - '0');
+			d->len++;
 		}
+		d->c = d->len;
+		break;
+	case GK_STO:
+		d->k = a == '.' ? GD_JMP : ra ? GD_SLW : GD_STO;
+		d->len = 2;
+		break;
+	case GK_LIT: d->k = GD_LIT; d->len = 2; break;
+	case GK_ADD: case GK_SUB: case GK_MUL: case GK_DIV: case GK_MOD:
+	case GK_AND: case GK_OR: case GK_XOR:
+		d->k = ra || rb ? GD_SLW : glyph_cls[op] - GK_ADD + GD_ADD;
+		d->len = 3;
+		break;
+	case GK_SHL: case GK_SHR: case GK_NOT:
+		d->k = ra ? GD_SLW : glyph_cls[op] - GK_SHL + GD_SHL;
+		d->len = 2;
+		break;
+	case GK_MEM: case GK_PRT:
+		d->len = 3;
+		d->k = a == '<' ? (op == '@' ? GD_MLD : GD_PIN) :
+		       a == '>' ? (op == '@' ? GD_MST : GD_POU) : GD_SKP;
+		if (d->k != GD_SKP && rb) d->k = GD_SLW;
+		break;
+	case GK_CMP:
+		d->len = 3;
+		d->k = a == '=' ? GD_CEQ : a == '!' ? GD_CNE :
+		       a == '<' ? GD_CLT : a == '>' ? GD_CGT : GD_SKP;
+		if (d->k != GD_SKP && rb) d->k = GD_SLW;
+		break;
+	case GK_CMV:
+		d->k = a == '.' ? GD_CJP : ra ? GD_SLW : GD_CMV;
+		d->len = 2;
+		break;
+	case GK_CAL: d->k = ra ? GD_SLW : GD_CAL; d->len = 2; break;
+	case GK_HLT: d->k = GD_HLT; break;
+	case GK_CPY:
+		d->b = op; d->len = 2;
+		if (op == '.' && !ra)
+			d->k = GD_LBL;
+		else if (glyph_special(op))
+			d->k = GD_SLW;
+		else
+			d->k = a == '.' ? GD_JPR : a == '=' ? GD_CPA :
+			       ra ? GD_SLW : GD_CPY;
+		break;
+	}
+}
+
+/* Kinds whose result does not depend on the incoming '='. */
+static inline bool glyph_acc_free(u8 k) {
+	switch (k) {
+	case GD_NOP: case GD_LIT: case GD_ADD: case GD_SUB: case GD_MUL:
+	case GD_DIV: case GD_MOD: case GD_AND: case GD_OR:  case GD_XOR:
+	case GD_NOT: case GD_CPA: case GD_LTS: case GD_LTO: case GD_CLD:
+	case GD_CJR:
+		return true;
 	}
+	return false;
 }
 
+/* Kinds that open with a folded immediate (acc = acc * mul + add). */
+static inline bool glyph_imm_led(u8 k) {
+	return k == GD_IMM || k == GD_IMS || k == GD_IMJ ||
+	       (k >= GD_IEQ && k <= GD_IGT);
+}
+
+/* Decode the rune at x, fusing what follows into at most room bytes. */
+static void glyph_decode_fused(Glyph *vm, u8 x, GlyphOp *d, int room) {
+	GlyphOp n, c;
+	int len;
+	bool blank;
+	glyph_decode_rune(vm, x, d);
+	glyph_decode_rune(vm, x + d->len, &n);
+	switch (d->k) {
+	case GD_NOP:
+		if (room < 2) break;
+		glyph_decode_fused(vm, x + 1, &n, room - 1);
+		/* a digit run is not cut to room: leave it out if it overhangs */
+		if (n.len + 1 > room) break;
+		if (!glyph_acc_free(n.k) && !glyph_imm_led(n.k)) break;
+		if (glyph_imm_led(n.k)) n.mul = 0;
+		*d = n;
+		d->len++;
+		d->c++;
+		break;
+	case GD_IMM:
+		if (d->len + n.len > room) break;
+		if (n.k == GD_STO) {
+			d->k = GD_IMS; d->a = n.a;
+		} else if (n.k == GD_JMP) {
+			d->k = GD_IMJ;
+		} else if (n.k >= GD_CEQ && n.k <= GD_CGT) {
+			d->k = n.k - GD_CEQ + GD_IEQ; d->b = n.b;
+		} else break;
+		d->len += n.len;
+		d->c += n.c;
+		break;
+	case GD_LIT:
+		if (d->len + n.len > room) break;
+		if (n.k == GD_STO) {
+			d->k = GD_LTS; d->b = n.a;
+		} else if (n.k == GD_POU) {
+			d->k = GD_LTO; d->b = n.b;
+		} else break;
+		d->len += n.len;
+		d->c += n.c;
+		break;
+	case GD_CEQ: case GD_CNE: case GD_CLT: case GD_CGT:
+		len = d->len;
+		if ((blank = n.k == GD_NOP))
+			glyph_decode_rune(vm, x + ++len, &n);
+		if (n.k != GD_IMM) break;
+		glyph_decode_rune(vm, x + len + n.len, &c);
+		if (c.k != GD_CJP || len + n.len + c.len > room) break;
+		d->k = d->k - GD_CEQ + GD_BEQ;
+		d->mul = blank ? 0 : n.mul; d->add = n.add;
+		d->len = len + n.len + c.len;
+		d->c = 1 + blank + n.c + c.c;
+		break;
+	case GD_CPA:
+		if (d->len + n.len > room) break;
+		if (n.k == GD_MLD) {
+			d->k = GD_CLD; d->a = n.b;
+		} else if (n.k == GD_CJP) {
+			d->k = GD_CJR;
+		} else break;
+		d->len += n.len;
+		d->c += n.c;
+		break;
+	}
+}
+
+/* Decode the rune at x into vm->d[x]. Nothing is fused across the end
+ * of the void, and a rune that reaches it runs through glyph_step, so
+ * every way around the void passes a budget check. */
+void glyph_decode(Glyph *vm, u8 x) {
+	GlyphOp *d = &vm->d[x];
+	glyph_decode_fused(vm, x, d, SIZE - x < GLYPH_SPAN ? SIZE - x : GLYPH_SPAN);
+	if (x + d->len >= SIZE) {
+		d->k = GD_SLW;
+		d->c = 1;
+	}
+}
+
+/* Pre-decoded engine: runs from vm->d, decoding lazily on first visit and
+ * again after glyph_poke dirties an entry. Digit runs are folded. Each
+ * handler advances pc by its own length so dispatch is a single load.
+ * Runes are counted as entries retire (DNEXT) but the budget is only
+ * checked where control can leave a straight run (DJUMP). An entry that
+ * calls out to a device is counted first and the count written back with
+ * the rest (DOUT), so a snapshot taken in the callback has it current. */
+/* Tracing records each entry as it is dispatched, by its first rune: a
+ * fused run or a folded immediate is one record. Dirty entries are
+ * recorded once decoded and GD_SLW in glyph_step. */
+#ifdef GLYPH_TRACE
+#define DTRACE do { if (d->k > GD_SLW) TRACE(pc, vm->m[pc], acc, flg); } while (0)
+#else
+#define DTRACE ((void)0)
+#endif
+#if defined(__GNUC__)
+#define OP(k) case GD_##k: k:
+#define DAGAIN do { d = &vm->d[pc]; DTRACE; goto *lab[d->k]; } while (0)
+#define DNEXT do { n += d->c; d = &vm->d[pc]; DTRACE; goto *lab[d->k]; } while (0)
+#define DGO do { if (n >= end) goto stop; \
+	d = &vm->d[pc]; DTRACE; goto *lab[d->k]; } while (0)
+#else
+#define OP(k) case GD_##k:
+#define DAGAIN continue
+#define DNEXT { n += d->c; continue; }
+#define DGO { if (n >= end) goto stop; continue; }
+#endif
+#define DJUMP do { n += d->c; DGO; } while (0)
+#define DOUT() (TSYNC(), vm->n = n += d->c)
+#define DIN() (TLOAD(), n = vm->n)
+#define V(x) vm->r[(x)]
+
+static int glyph_run_decoded(Glyph *vm, uint64_t budget) {
+#if defined(__GNUC__)
+	static void *const lab[GD_N] = {
+		[GD_DTY]=&&DTY, [GD_SLW]=&&SLW, [GD_NOP]=&&NOP, [GD_IMM]=&&IMM,
+		[GD_STO]=&&STO, [GD_JMP]=&&JMP, [GD_LIT]=&&LIT, [GD_ADD]=&&ADD,
+		[GD_SUB]=&&SUB, [GD_MUL]=&&MUL, [GD_DIV]=&&DIV, [GD_MOD]=&&MOD,
+		[GD_AND]=&&AND, [GD_OR]=&&OR,   [GD_XOR]=&&XOR, [GD_SHL]=&&SHL,
+		[GD_SHR]=&&SHR, [GD_NOT]=&&NOT, [GD_MLD]=&&MLD, [GD_MST]=&&MST,
+		[GD_PIN]=&&PIN, [GD_POU]=&&POU, [GD_CEQ]=&&CEQ, [GD_CNE]=&&CNE,
+		[GD_CLT]=&&CLT, [GD_CGT]=&&CGT, [GD_CMV]=&&CMV, [GD_CJP]=&&CJP,
+		[GD_CAL]=&&CAL, [GD_CPY]=&&CPY, [GD_CPA]=&&CPA, [GD_JPR]=&&JPR,
+		[GD_LBL]=&&LBL, [GD_SKP]=&&SKP, [GD_HLT]=&&HLT,
+		[GD_IMS]=&&IMS, [GD_IMJ]=&&IMJ, [GD_LTS]=&&LTS, [GD_LTO]=&&LTO,
+		[GD_IEQ]=&&IEQ, [GD_INE]=&&INE, [GD_ILT]=&&ILT, [GD_IGT]=&&IGT,
+		[GD_BEQ]=&&BEQ, [GD_BNE]=&&BNE, [GD_BLT]=&&BLT, [GD_BGT]=&&BGT,
+		[GD_CLD]=&&CLD, [GD_CJR]=&&CJR,
+	};
+#endif
+	const GlyphOp *d;
+	u8 pc, acc, flg, a;
+	uint64_t n = vm->n, end = budget > UINT64_MAX - n ? UINT64_MAX : n + budget;
+	vm->wait = 0;
+	if (vm->halt) return GLYPH_HALT;
+	TLOAD();
+	for (;;) {
+		d = &vm->d[pc];
+		DTRACE;
+		switch (d->k) {
+		OP(DTY) glyph_decode(vm, pc); DAGAIN;
+		OP(SLW) DOUT(); glyph_step(vm); DIN();
+			if (vm->wait) { n -= d->c; goto wait; }
+			if (vm->halt) goto out;
+			DGO;
+		OP(NOP) pc += d->len; acc = 0; DNEXT;
+		OP(IMM) pc += d->len; acc = acc * d->mul + d->add; DNEXT;
+		OP(STO) pc += 2; V(d->a) = acc; acc = 0; DNEXT;
+		OP(JMP) pc = acc; acc = 0; DJUMP;
+		OP(LIT) pc += d->len; acc = d->a; DNEXT;
+		OP(ADD) pc += d->len; acc = V(d->a) + V(d->b); DNEXT;
+		OP(SUB) pc += d->len; acc = V(d->a) - V(d->b); DNEXT;
+		OP(MUL) pc += d->len; acc = V(d->a) * V(d->b); DNEXT;
+		OP(DIV) pc += d->len; a = V(d->b); acc = a ? V(d->a) / a : 0; DNEXT;
+		OP(MOD) pc += d->len; a = V(d->b); acc = a ? V(d->a) % a : 0; DNEXT;
+		OP(AND) pc += d->len; acc = V(d->a) & V(d->b); DNEXT;
+		OP(OR)  pc += d->len; acc = V(d->a) | V(d->b); DNEXT;
+		OP(XOR) pc += d->len; acc = V(d->a) ^ V(d->b); DNEXT;
+		OP(SHL) pc += 2; acc = acc > 7 ? 0 : V(d->a) << acc; DNEXT;
+		OP(SHR) pc += 2; acc = acc > 7 ? 0 : V(d->a) >> acc; DNEXT;
+		OP(NOT) pc += d->len; acc = ~V(d->a); DNEXT;
+		OP(MLD) pc += 3; V(d->b) = vm->m[acc]; DNEXT;
+		OP(MST) pc += 3; glyph_poke(vm, acc, V(d->b)); DNEXT;
+		OP(PIN) pc += 3; DOUT(); if (vm->h) vm->h(vm, acc); DIN();
+			if (vm->wait) { pc -= 3; n -= d->c; goto wait; }
+			V(d->b) = vm->p[acc];
+			if (vm->halt) goto out;
+			DGO;
+		OP(POU) pc += 3; vm->p[acc] = V(d->b);
+			DOUT(); if (vm->e) vm->e(vm, acc); DIN();
+			if (vm->halt) goto out;
+			DGO;
+		OP(CEQ) pc += 3; flg = acc == V(d->b); DNEXT;
+		OP(CNE) pc += 3; flg = acc != V(d->b); DNEXT;
+		OP(CLT) pc += 3; flg = acc <  V(d->b); DNEXT;
+		OP(CGT) pc += 3; flg = acc >  V(d->b); DNEXT;
+		OP(CMV) pc += 1; if (flg) { pc += 1; V(d->a) = acc; }
+			acc = 0; DNEXT;
+		OP(CJP) pc += 1; if (flg) pc = acc; acc = 0; DJUMP;
+		OP(CAL) vm->s[vm->T++] = pc + 1; pc = V(d->a); DJUMP;
+		OP(CPY) pc += 2; V(d->a) = V(d->b); DNEXT;
+		OP(CPA) pc += d->len; acc = V(d->b); DNEXT;
+		OP(JPR) pc = V(d->b); DJUMP;
+		OP(LBL) pc += 2; V(d->a) = pc; DNEXT;
+		OP(SKP) pc += 3; DNEXT;
+		OP(HLT) pc += 1; vm->halt = 1; n += 1; goto out;
+		OP(IMS) pc += d->len; V(d->a) = acc * d->mul + d->add; acc = 0;
+			DNEXT;
+		OP(IMJ) pc = acc * d->mul + d->add; acc = 0; DJUMP;
+		OP(LTS) pc += d->len; V(d->b) = d->a; acc = 0; DNEXT;
+		OP(LTO) pc += d->len; acc = d->a; vm->p[acc] = V(d->b);
+			DOUT(); if (vm->e) vm->e(vm, acc); DIN();
+			if (vm->halt) goto out;
+			DGO;
+		OP(IEQ) pc += d->len; acc = acc * d->mul + d->add;
+			flg = acc == V(d->b); DNEXT;
+		OP(INE) pc += d->len; acc = acc * d->mul + d->add;
+			flg = acc != V(d->b); DNEXT;
+		OP(ILT) pc += d->len; acc = acc * d->mul + d->add;
+			flg = acc <  V(d->b); DNEXT;
+		OP(IGT) pc += d->len; acc = acc * d->mul + d->add;
+			flg = acc >  V(d->b); DNEXT;
+		OP(BEQ) flg = acc == V(d->b); goto branch;
+		OP(BNE) flg = acc != V(d->b); goto branch;
+		OP(BLT) flg = acc <  V(d->b); goto branch;
+		OP(BGT) flg = acc >  V(d->b);
+		branch:	acc = acc * d->mul + d->add;
+			if (flg) { pc = acc; acc = 0; DJUMP; }
+			pc += d->len - 1; acc = 0; DNEXT;
+		OP(CLD) pc += d->len; acc = V(d->b); V(d->a) = vm->m[acc]; DNEXT;
+		OP(CJR) acc = V(d->b);
+			if (flg) { pc = acc; acc = 0; DJUMP; }
+			pc += d->len - 1; acc = 0; DNEXT;
+		}
+	}
+out:	TSYNC(); vm->n = n;
+	return GLYPH_HALT;
+stop:	TSYNC(); vm->n = n;
+	return GLYPH_BUDGET;
+wait:	TSYNC(); vm->n = n;
+	return GLYPH_WAIT;
+}
+
+#undef OP
+#undef DTRACE
+#undef DAGAIN
+#undef DNEXT
+#undef DGO
+#undef DJUMP
+#undef DOUT
+#undef DIN
+#undef V
+#undef TR
+#undef TW
+#undef TSYNC
+#undef TLOAD
+
+void glyph_eval_decoded(Glyph *vm) {
+	while (glyph_run_decoded(vm, UINT64_MAX) == GLYPH_BUDGET)
+		;
+}
+
+#ifndef GLYPH_PROFILE
+int glyph_step_n(Glyph *vm, uint64_t budget) {
+	return glyph_run_decoded(vm, budget);
+}
+#endif
+
+#else
+void glyph_eval_threaded(Glyph *vm) { glyph_eval_switch(vm); }
+void glyph_eval_decoded(Glyph *vm) { glyph_eval_switch(vm); }
+void glyph_decode(Glyph *vm, u8 x) { (void)vm; (void)x; }
+#endif /* GLYPH_BITS == 8 */
+
+/* Rune by rune on the switch: wide builds, and profiling builds so
+ * every rune is seen. */
+#if GLYPH_BITS > 8 || defined(GLYPH_PROFILE)
+int glyph_step_n(Glyph *vm, uint64_t budget) {
+	vm->wait = 0;
+	for (; budget && !vm->halt; budget--) {
+		vm->n++;	/* counted before any callback, as decoded does */
+		glyph_step(vm);
+		if (vm->wait) {
+			vm->n--;
+			return GLYPH_WAIT;
+		}
+	}
+	return vm->halt ? GLYPH_HALT : GLYPH_BUDGET;
+}
+#endif
+
+/* GLYPH_JIT, GLYPH_DECODED and GLYPH_THREADED pick the glyph_eval engine;
+ * threaded needs computed goto, everything else runs the portable switch.
+ * GLYPH_PROFILE overrides them all with the switch. Every engine
+ * traces under GLYPH_TRACE, the decoded one by entry and the JIT by
+ * block. */
+void glyph_eval(Glyph *vm) {
+#if defined(GLYPH_PROFILE)
+	glyph_eval_switch(vm);
+#elif defined(GLYPH_JIT)
+	glyph_eval_jit(vm);
+#elif defined(GLYPH_DECODED)
+	glyph_eval_decoded(vm);
+#elif defined(GLYPH_THREADED) && defined(__GNUC__)
+	glyph_eval_threaded(vm);
+#else
+	glyph_eval_switch(vm);
+#endif
+}
+
+#undef GLYPH_AT
+#undef PROF
+#undef TRACE
+#undef TRACE_N
 #undef R
+#undef WR
 #undef M
+#undef P
 #undef ACC
 #undef FLG
+#undef A
 #undef N
 
+#if defined(GLYPH_JIT)
+#include "glyph_jit.h"
+#endif
+
 #endif /* GLYPH_IMPL */
 
 #endif /* GLYPH_H */
@@ -0,0 +1,418 @@
+/* GLYPH_BATCH - run one program over many VMs in lockstep (8-bit builds)
+ * Usage: include after glyph.h in the GLYPH_IMPL file.
+ *
+ * A GlyphBatch keeps GLYPH_LANES VMs as structure-of-arrays: byte x of
+ * lane l's void is m[x][l], vessel v is r[v][l]. Each step runs one rune
+ * for every live lane whose '.' equals the batch pc, as GCC vector
+ * operations on whole rows, as wide as the target's vector registers. Lanes
+ * that branch elsewhere are masked off. When lanes split, the batch goes
+ * on with the lowest pc, so lanes that left a loop wait at its exit for
+ * the rest. The void, stack and ports are indexed per lane and run lane
+ * by lane.
+ *
+ * A lane whose code bytes at the pc differ from the others sits out that
+ * rune. When fewer than a quarter of the live lanes have been running for
+ * GLYPH_BATCH_PATIENCE runes, every live lane is finished on its own with
+ * glyph_eval. Resonance callbacks get the batch and the lane; hear
+ * callbacks must answer at once (vm->wait is not supported here).
+ */
+#ifndef GLYPH_BATCH_H
+#define GLYPH_BATCH_H
+
+#include "glyph.h"
+
+/* One vector register of lanes; -DGLYPH_LANES=... for more, a multiple
+ * of 8 up to 64, as lane masks are uint64_t. */
+#ifndef GLYPH_LANES
+#if defined(__AVX512BW__)
+#define GLYPH_LANES 64
+#elif defined(__AVX2__)
+#define GLYPH_LANES 32
+#else
+#define GLYPH_LANES 16
+#endif
+#endif
+#if GLYPH_LANES > 64 || GLYPH_LANES % 8
+#error "GLYPH_LANES must be a multiple of 8 up to 64"
+#endif
+#ifndef GLYPH_BATCH_PATIENCE
+#define GLYPH_BATCH_PATIENCE 256
+#endif
+
+typedef struct GlyphBatch GlyphBatch;
+typedef void (*GlyphLaneR)(GlyphBatch *b, int lane, u8 p);
+
+struct GlyphBatch {
+	_Alignas(GLYPH_LANES > 64 ? 64 : GLYPH_LANES) u8 m[SIZE][GLYPH_LANES];
+	u8 r[SIZE][GLYPH_LANES], s[SIZE][GLYPH_LANES], p[SIZE][GLYPH_LANES];
+	u8 T[GLYPH_LANES], halt[GLYPH_LANES];
+	GlyphLaneR e, h;
+	void *ctx;
+	u8 mix[SIZE];		/* lanes may differ at x */
+	uint64_t steps;		/* lockstep runes */
+	int spilled;		/* lanes finished by glyph_eval */
+};
+
+void glyph_batch_load(GlyphBatch *b, const u8 *prog, size_t len);
+void glyph_batch_run(GlyphBatch *b);
+
+/* ────────────────────────────────────────────────────────────────────────── */
+#ifdef GLYPH_IMPL
+
+#if GLYPH_BITS != 8
+#error "glyph_batch.h needs GLYPH_BITS == 8"
+#endif
+
+/* Clear b and put prog at 0 in every lane's void. */
+void glyph_batch_load(GlyphBatch *b, const u8 *prog, size_t len) {
+	memset(b, 0, sizeof(*b));
+	for (size_t x = 0; x < len && x < SIZE; x++)
+		memset(b->m[x], prog[x], GLYPH_LANES);
+}
+
+typedef struct {
+	GlyphBatch *b;
+	int lane;
+} GlyphLane;
+
+static void glyph_lane_emit(Glyph *vm, u8 p) {
+	GlyphLane *l = vm->ctx;
+	l->b->p[p][l->lane] = vm->p[p];
+	if (l->b->e) l->b->e(l->b, l->lane, p);
+	vm->halt |= l->b->halt[l->lane];
+}
+
+static void glyph_lane_hear(Glyph *vm, u8 p) {
+	GlyphLane *l = vm->ctx;
+	if (l->b->h) l->b->h(l->b, l->lane, p);
+	vm->p[p] = l->b->p[p][l->lane];
+	vm->halt |= l->b->halt[l->lane];
+}
+
+/* Finish one lane as a plain VM and copy it back. */
+static void glyph_batch_spill(GlyphBatch *b, int lane) {
+	Glyph vm;
+	GlyphLane l = { b, lane };
+	memset(&vm, 0, sizeof(vm));
+	for (int x = 0; x < SIZE; x++) {
+		vm.m[x] = b->m[x][lane];
+		vm.r[x] = b->r[x][lane];
+		vm.s[x] = b->s[x][lane];
+		vm.p[x] = b->p[x][lane];
+	}
+	vm.T = b->T[lane];
+	vm.e = glyph_lane_emit;
+	vm.h = glyph_lane_hear;
+	vm.ctx = &l;
+	glyph_eval(&vm);
+	for (int x = 0; x < SIZE; x++) {
+		b->m[x][lane] = vm.m[x];
+		b->r[x][lane] = vm.r[x];
+		b->s[x][lane] = vm.s[x];
+		b->p[x][lane] = vm.p[x];
+	}
+	b->T[lane] = vm.T;
+	b->halt[lane] = 1;
+	b->spilled++;
+}
+
+#if defined(__GNUC__)
+#if defined(__SSE2__) && GLYPH_LANES % 16 == 0
+#include <emmintrin.h>
+#endif
+
+typedef u8 GlyphVec __attribute__((vector_size(GLYPH_LANES)));
+
+#define GB_SEL(k, a, b) (((a) & (k)) | ((b) & ~(k)))
+#define GB_IS(x) ((GlyphVec)(x))	/* lane compare to 0x00/0xff */
+
+static inline GlyphVec gb_ld(const u8 *row) {
+	GlyphVec v;
+	memcpy(&v, row, sizeof(v));
+	return v;
+}
+
+static inline void gb_st(u8 *row, GlyphVec v) {
+	memcpy(row, &v, sizeof(v));
+}
+
+static inline GlyphVec gb_dup(u8 x) {
+	return (GlyphVec){0} + x;
+}
+
+/* Lane mask to one bit per lane. */
+static inline uint64_t gb_bits(GlyphVec k) {
+	uint64_t m = 0;
+#if defined(__SSE2__) && GLYPH_LANES % 16 == 0
+	__m128i x[GLYPH_LANES / 16];
+	memcpy(x, &k, sizeof(x));
+	for (int i = 0; i < GLYPH_LANES / 16; i++)
+		m |= (uint64_t)(uint16_t)_mm_movemask_epi8(x[i]) << 16 * i;
+#else
+	for (int l = 0; l < GLYPH_LANES; l++)
+		m |= (uint64_t)(k[l] >> 7) << l;
+#endif
+	return m;
+}
+
+/* Lowest '.' among the lanes in m. */
+static u8 gb_min(GlyphBatch *b, uint64_t m) {
+	u8 lo = 0xff;
+	for (; m; m &= m - 1) {
+		u8 pc = b->r['.'][__builtin_ctzll(m)];
+		if (pc < lo) lo = pc;
+	}
+	return lo;
+}
+
+static GlyphVec gb_get(GlyphBatch *b, u8 x, GlyphVec act) {
+	GlyphVec v = {0};
+	if (x != ',')
+		return gb_ld(b->r[x]);
+	for (int l = 0; l < GLYPH_LANES; l++)
+		if (act[l]) v[l] = b->s[--b->T[l]][l];
+	return v;
+}
+
+static void gb_set(GlyphBatch *b, u8 x, GlyphVec v, GlyphVec act) {
+	if (x != ',') {
+		gb_st(b->r[x], GB_SEL(act, v, gb_ld(b->r[x])));
+		return;
+	}
+	for (int l = 0; l < GLYPH_LANES; l++)
+		if (act[l]) b->s[b->T[l]++][l] = v[l];
+}
+
+/* Bytes the rune starting with op takes; ':' takes one more when '?'. */
+static int gb_len(u8 op) {
+	switch (op) {
+	case '+': case '-': case '*': case '/': case '%':
+	case '&': case '|': case '^': case '@': case '#': case '?':
+		return 3;
+	case '=': case '\'': case '<': case '>': case '~': case ';':
+		return 2;
+	case ':': case '`': case 0:
+		return 1;
+	}
+	return glyph_cls[op] == GK_NOP || glyph_cls[op] == GK_DIG ? 1 : 2;
+}
+
+/* Drop from *act the lanes in sub whose byte at x is not lane f's. */
+static void gb_same(GlyphBatch *b, u8 x, int f, GlyphVec sub, GlyphVec *act) {
+	*act &= ~(sub & GB_IS(gb_ld(b->m[x]) != gb_dup(b->m[x][f])));
+}
+
+/* Lanes have the same bytes wherever mix[x] is clear. */
+static void gb_mix(GlyphBatch *b) {
+	for (int x = 0; x < SIZE; x++)
+		b->mix[x] = gb_bits(GB_IS(gb_ld(b->m[x]) != gb_dup(b->m[x][0]))) != 0;
+}
+
+enum { GB_SPLIT = -1 };
+
+/* Run the rune at cur for the lanes in *act, all of which sit at cur.
+ * Lanes whose code bytes differ from the first one's are dropped from
+ * *act. Returns where the lanes run all went next, or GB_SPLIT when they
+ * may not agree, lanes were dropped or lanes halted. */
+static int gb_step(GlyphBatch *b, u8 cur, GlyphVec *actp, GlyphVec *live) {
+	GlyphVec act = *actp, acc, a, v = {0}, flg;
+	int f = __builtin_ctzll(gb_bits(act)), len, next;
+	u8 op = b->m[cur][f], o1, o2;
+	bool split = false;
+
+	len = gb_len(op);
+	if (b->mix[cur] | b->mix[(u8)(cur + 1)] | b->mix[(u8)(cur + 2)]) {
+		for (int k = 0; k < len; k++)
+			gb_same(b, cur + k, f, act, &act);
+		if (op == ':')
+			gb_same(b, cur + 1, f, act & GB_IS(gb_ld(b->r['?']) != 0), &act);
+		split = gb_bits(act) != gb_bits(*actp);
+		*actp = act;
+	}
+	o1 = b->m[(u8)(cur + 1)][f];
+	o2 = b->m[(u8)(cur + 2)][f];
+	next = (u8)(cur + len);
+
+#define PC(x) gb_st(b->r['.'], GB_SEL(act, gb_dup(x), gb_ld(b->r['.'])))
+#define ACCV gb_ld(b->r['='])
+#define SETACC(x) gb_set(b, '=', (x), act)
+	switch (op) {
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		PC(cur + 1);
+		SETACC(ACCV * 10 + gb_dup(op - '0'));
+		break;
+	case '=':
+		PC(cur + 2); gb_set(b, o1, ACCV, act); SETACC(gb_dup(0));
+		split |= o1 == '.';
+		break;
+	case '\'':
+		PC(cur + 2); SETACC(gb_dup(o1));
+		break;
+	case '+': case '-': case '*': case '/': case '%':
+	case '&': case '|': case '^':
+		PC(cur + 2); a = gb_get(b, o1, act);
+		PC(cur + 3); v = gb_get(b, o2, act);
+		switch (op) {
+		case '+': SETACC(a + v); break;
+		case '-': SETACC(a - v); break;
+		case '*': SETACC(a * v); break;
+		case '/': SETACC((a / (v | (GB_IS(v == 0) & 1))) & GB_IS(v != 0)); break;
+		case '%': SETACC((a % (v | (GB_IS(v == 0) & 1))) & GB_IS(v != 0)); break;
+		case '&': SETACC(a & v); break;
+		case '|': SETACC(a | v); break;
+		case '^': SETACC(a ^ v); break;
+		}
+		break;
+	case '<': case '>':
+		PC(cur + 2); a = gb_get(b, o1, act); acc = ACCV;
+		v = op == '<' ? a << (acc & 7) : a >> (acc & 7);
+		SETACC(v & GB_IS(acc < 8));
+		break;
+	case '~':
+		PC(cur + 2); SETACC(~gb_get(b, o1, act));
+		break;
+	case '@':
+		PC(cur + 3); acc = ACCV;
+		if (o1 == '<') {
+			for (int l = 0; l < GLYPH_LANES; l++)
+				v[l] = b->m[acc[l]][l];
+			gb_set(b, o2, v, act);
+			split |= o2 == '.';
+		} else if (o1 == '>') {
+			v = gb_get(b, o2, act);
+			for (int l = 0; l < GLYPH_LANES; l++)
+				if (act[l]) {
+					b->m[acc[l]][l] = v[l];
+					b->mix[acc[l]] = 1;
+				}
+		}
+		break;
+	case '#':
+		PC(cur + 3); acc = ACCV;
+		if (o1 == '<') {
+			for (int l = 0; l < GLYPH_LANES; l++)
+				if (act[l]) {
+					if (b->h) b->h(b, l, acc[l]);
+					v[l] = b->p[acc[l]][l];
+				}
+			gb_set(b, o2, v, act);
+		} else if (o1 == '>') {
+			v = gb_get(b, o2, act);
+			for (int l = 0; l < GLYPH_LANES; l++)
+				if (act[l]) {
+					b->p[acc[l]][l] = v[l];
+					if (b->e) b->e(b, l, acc[l]);
+				}
+		}
+		*live &= GB_IS(gb_ld(b->halt) == 0);
+		split = true;
+		break;
+	case '?':
+		PC(cur + 3); acc = ACCV;
+		switch (o1) {
+		case '=': v = GB_IS(acc == gb_get(b, o2, act)); break;
+		case '!': v = GB_IS(acc != gb_get(b, o2, act)); break;
+		case '<': v = GB_IS(acc <  gb_get(b, o2, act)); break;
+		case '>': v = GB_IS(acc >  gb_get(b, o2, act)); break;
+		default: goto done;
+		}
+		gb_set(b, '?', v & 1, act);
+		break;
+	case ':':
+		flg = act & GB_IS(gb_ld(b->r['?']) != 0);
+		PC(cur + 1);
+		gb_st(b->r['.'], GB_SEL(flg, gb_dup(cur + 2), gb_ld(b->r['.'])));
+		gb_set(b, o1, ACCV, flg);
+		SETACC(gb_dup(0));
+		if (gb_bits(flg) == gb_bits(act)) {
+			next = (u8)(cur + 2);
+			split |= o1 == '.';
+		} else if (gb_bits(flg)) {
+			split = true;
+		}
+		break;
+	case ';':
+		gb_set(b, ',', gb_dup(cur + 1), act);
+		PC(cur + 2);
+		gb_set(b, '.', gb_get(b, o1, act), act);
+		split = true;
+		break;
+	case '`': case 0:
+		PC(cur + 1);
+		gb_st(b->halt, GB_SEL(act, gb_dup(1), gb_ld(b->halt)));
+		*live &= ~act;
+		split = true;
+		break;
+	default:
+		if (len == 1) {	/* blank */
+			PC(cur + 1);
+			SETACC(gb_dup(0));
+			break;
+		}
+		PC(cur + 2); gb_set(b, o1, gb_get(b, op, act), act);
+		split |= o1 == '.';
+		break;
+	}
+done:
+#undef PC
+#undef ACCV
+#undef SETACC
+	return split ? GB_SPLIT : next;
+}
+
+void glyph_batch_run(GlyphBatch *b) {
+	GlyphVec live = GB_IS(gb_ld(b->halt) == 0), act;
+	uint64_t lm = gb_bits(live), am, was = 0;
+	int low = 0, next;
+	bool thin = false;
+	u8 cur;
+
+	if (!lm)
+		return;
+	gb_mix(b);
+	cur = gb_min(b, lm);
+	for (;;) {
+		act = live & GB_IS(gb_ld(b->r['.']) == gb_dup(cur));
+		if ((am = gb_bits(act)) != was) {
+			thin = __builtin_popcountll(am) * 4 < __builtin_popcountll(lm);
+			was = am;
+		}
+		low = thin ? low + 1 : 0;
+		if (low > GLYPH_BATCH_PATIENCE) {
+			for (; lm; lm &= lm - 1)
+				glyph_batch_spill(b, __builtin_ctzll(lm));
+			return;
+		}
+		b->steps++;
+		if ((next = gb_step(b, cur, &act, &live)) != GB_SPLIT) {
+			cur = next;
+			continue;
+		}
+		/* stay with the lanes just run while they agree */
+		if (!(lm = gb_bits(live)))
+			return;
+		am = gb_bits(act) & lm;
+		if (am) {
+			cur = b->r['.'][__builtin_ctzll(am)];
+			if (am & gb_bits(GB_IS(gb_ld(b->r['.']) != gb_dup(cur))))
+				cur = gb_min(b, lm);
+		} else {
+			cur = gb_min(b, lm);
+		}
+	}
+}
+
+#undef GB_SEL
+#undef GB_IS
+
+#else
+/* No vector extensions: every lane runs on its own. */
+void glyph_batch_run(GlyphBatch *b) {
+	for (int l = 0; l < GLYPH_LANES; l++)
+		if (!b->halt[l]) glyph_batch_spill(b, l);
+}
+#endif /* __GNUC__ */
+
+#endif /* GLYPH_IMPL */
+#endif /* GLYPH_BATCH_H */
@@ -0,0 +1,606 @@
+/* GLYPH_JIT - x86-64 translator for glyph.h (Linux, 8-bit vessels)
+ * Usage: include after glyph.h in the GLYPH_IMPL file, or build with
+ * -DGLYPH_JIT to make glyph_eval use it; glyph_eval_jit keeps its
+ * translators in pthread keys. Elsewhere glyph_eval_jit runs
+ * glyph_eval_decoded.
+ *
+ * A block is the straight run of runes from one entry address up to the
+ * first transfer of control, resonance or rune it cannot translate
+ * (anything decoded as GD_SLW), at most GLYPH_JIT_SPAN bytes. '=' and '?'
+ * live in r12d and r13d, vm in rbx; the block leaves '.' in vm->r and
+ * returns. Untranslatable runes run through glyph_step. Under
+ * GLYPH_TRACE a block is one record, made by the dispatcher as it enters.
+ *
+ * Every block keeps a copy of the bytes it was made from and marks them
+ * in vm->tm. glyph_poke bumps vm->gen when it lands on a marked byte and
+ * widens vm->tlo..thi; the block that made the write returns at once and
+ * the dispatcher drops the blocks over those bytes that no longer match.
+ * A byte that has taken blocks with it GLYPH_JIT_HOT times is left out of
+ * translation from then on: blocks end before it and it runs through
+ * glyph_step, so code that keeps rewriting itself is not translated over
+ * and over.
+ */
+#ifndef GLYPH_JIT_H
+#define GLYPH_JIT_H
+
+#include "glyph.h"
+
+#define GLYPH_JIT_SPAN 64
+#define GLYPH_JIT_CODE (1 << 20)
+#define GLYPH_JIT_HOT 4
+
+typedef void (*GlyphBlock)(Glyph *vm);
+
+typedef struct {
+	u8 *code, *at;
+	GlyphBlock blk[SIZE];
+	u8 n[SIZE];
+	u8 src[SIZE][GLYPH_JIT_SPAN];
+	u8 own[SIZE];	/* blocks over each byte */
+	u8 hot[SIZE];	/* blocks each byte dropped by changing */
+	unsigned gen;
+	unsigned made;	/* blocks translated */
+} GlyphJit;
+
+GlyphJit *glyph_jit_new(void);
+void glyph_jit_free(GlyphJit *j);
+void glyph_jit_run(GlyphJit *j, Glyph *vm);
+
+/* ────────────────────────────────────────────────────────────────────────── */
+#ifdef GLYPH_IMPL
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__linux__) && GLYPH_BITS == 8
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS 0x20 /* hidden by -std=c11; fixed on Linux */
+#endif
+#define GLYPH_JIT_PAGE 4096
+#define GLYPH_JIT_MAX (GLYPH_JIT_SPAN * 96)	/* code for one block, at most */
+
+enum { JX_AX = 0, JX_CX = 1, JX_DX = 2, JX_SI = 6, JX_ACC = 12, JX_FLG = 13 };
+enum { JX_B = 2, JX_E = 4, JX_NE = 5, JX_A = 7 };
+
+#define JX_R(x) (offsetof(Glyph, r) + (x))
+#define JX_M offsetof(Glyph, m)
+#define JX_S offsetof(Glyph, s)
+#define JX_T offsetof(Glyph, T)
+#define JX_HALT offsetof(Glyph, halt)
+
+/* What the translator knows about '=' at the current rune: kn if it
+ * holds the constant kv, kr if r12d is current. */
+typedef struct {
+	bool kn, kr;
+	u8 kv;
+} JxAcc;
+
+static void jx_b(GlyphJit *j, u8 v) { *j->at++ = v; }
+static void jx_d(GlyphJit *j, uint32_t v) { memcpy(j->at, &v, 4); j->at += 4; }
+
+static void jx_rex(GlyphJit *j, int r, int x, int b) {
+	if (r > 7 || x > 7 || b > 7)
+		jx_b(j, 0x40 | (r > 7) << 2 | (x > 7) << 1 | (b > 7));
+}
+
+/* [rbx + disp32] operand with reg in the middle field. */
+static void jx_mem(GlyphJit *j, int reg, uint32_t disp) {
+	jx_b(j, 0x80 | (reg & 7) << 3 | 3);
+	jx_d(j, disp);
+}
+
+/* movzx reg, byte [rbx + disp] */
+static void jx_ld(GlyphJit *j, int reg, uint32_t disp) {
+	jx_rex(j, reg, 0, 0); jx_b(j, 0x0f); jx_b(j, 0xb6); jx_mem(j, reg, disp);
+}
+
+/* mov byte [rbx + disp], reg8 (al, cl, dl, r12b or r13b) */
+static void jx_st(GlyphJit *j, int reg, uint32_t disp) {
+	jx_rex(j, reg, 0, 0); jx_b(j, 0x88); jx_mem(j, reg, disp);
+}
+
+/* mov byte [rbx + disp], imm8 */
+static void jx_sti(GlyphJit *j, uint32_t disp, u8 v) {
+	jx_b(j, 0xc6); jx_mem(j, 0, disp); jx_b(j, v);
+}
+
+static void jx_movi(GlyphJit *j, int reg, uint32_t v) {
+	jx_rex(j, 0, 0, reg); jx_b(j, 0xb8 | (reg & 7)); jx_d(j, v);
+}
+
+/* op dst, src for the 32-bit "op r/m, r" forms (mov, add, cmp, ...). */
+static void jx_rr(GlyphJit *j, u8 op, int dst, int src) {
+	jx_rex(j, src, 0, dst); jx_b(j, op); jx_b(j, 0xc0 | (src & 7) << 3 | (dst & 7));
+}
+
+/* movzx dst, src8 */
+static void jx_zx(GlyphJit *j, int dst, int src) {
+	jx_rex(j, dst, 0, src); jx_b(j, 0x0f); jx_b(j, 0xb6);
+	jx_b(j, 0xc0 | (dst & 7) << 3 | (src & 7));
+}
+
+static u8 *jx_jcc(GlyphJit *j, int cc) {
+	jx_b(j, 0x0f); jx_b(j, 0x80 | cc); jx_d(j, 0);
+	return j->at;
+}
+
+static u8 *jx_jmp(GlyphJit *j) {
+	jx_b(j, 0xe9); jx_d(j, 0);
+	return j->at;
+}
+
+static void jx_land(GlyphJit *j, u8 *after) {
+	int32_t rel = (int32_t)(j->at - after);
+	memcpy(after - 4, &rel, 4);
+}
+
+static void jx_call(GlyphJit *j, void *fn) {
+	uint64_t a = (uint64_t)(uintptr_t)fn;
+	jx_b(j, 0x48); jx_rr(j, 0x89, 7, 3);	/* mov rdi, rbx */
+	jx_b(j, 0x48); jx_b(j, 0xb8); jx_d(j, a); jx_d(j, a >> 32);
+	jx_b(j, 0xff); jx_b(j, 0xd0);
+}
+
+/* Make r12d hold '='. */
+static void jx_need(GlyphJit *j, JxAcc *s) {
+	if (s->kr) return;
+	if (s->kv) jx_movi(j, JX_ACC, s->kv);
+	else jx_rr(j, 0x31, JX_ACC, JX_ACC);
+	s->kr = 1;
+}
+
+static void jx_set(JxAcc *s, u8 v) { s->kn = 1; s->kv = v; s->kr = 0; }
+
+/* r12d was just computed from zero-extended bytes; truncate it. */
+static void jx_acc(GlyphJit *j, JxAcc *s, int src) {
+	jx_zx(j, JX_ACC, src);
+	s->kn = 0; s->kr = 1;
+}
+
+/* Write '=' and '?' back; '.' is stored by the caller. */
+static void jx_sync(GlyphJit *j, const JxAcc *s) {
+	if (s->kr) jx_st(j, JX_ACC, JX_R('='));
+	else jx_sti(j, JX_R('='), s->kv);
+	jx_st(j, JX_FLG, JX_R('?'));
+}
+
+static void jx_ret(GlyphJit *j) {
+	jx_b(j, 0x41); jx_b(j, 0x5d);	/* pop r13 */
+	jx_b(j, 0x41); jx_b(j, 0x5c);	/* pop r12 */
+	jx_b(j, 0x5b); jx_b(j, 0xc3);	/* pop rbx; ret */
+}
+
+static void jx_exit(GlyphJit *j, const JxAcc *s, u8 pc) {
+	jx_sti(j, JX_R('.'), pc);
+	jx_sync(j, s);
+	jx_ret(j);
+}
+
+/* Exit to the address in eax. */
+static void jx_exit_ax(GlyphJit *j, const JxAcc *s) {
+	jx_st(j, JX_AX, JX_R('.'));
+	jx_sync(j, s);
+	jx_ret(j);
+}
+
+static int glyph_jit_poke(Glyph *vm, u8 x, u8 v) {
+	unsigned gen = vm->gen;
+	glyph_poke(vm, x, v);
+	return vm->gen != gen;
+}
+
+static void glyph_jit_in(Glyph *vm, u8 b) {
+	if (vm->h) vm->h(vm, vm->r['=']);
+	if (vm->wait) {
+		vm->r['.'] -= 3;
+		return;
+	}
+	vm->r[b] = vm->p[vm->r['=']];
+}
+
+static void glyph_jit_out(Glyph *vm, u8 b) {
+	vm->p[vm->r['=']] = vm->r[b];
+	if (vm->e) vm->e(vm, vm->r['=']);
+}
+
+static void glyph_jit_reset(GlyphJit *j, Glyph *vm) {
+	memset(j->blk, 0, sizeof(j->blk));
+	memset(j->own, 0, sizeof(j->own));
+	memset(vm->tm, 0, sizeof(vm->tm));
+	j->at = j->code;
+}
+
+static void glyph_jit_mark(GlyphJit *j, Glyph *vm, u8 x) {
+	for (int i = 0; i < j->n[x]; i++) {
+		u8 y = x + i;
+		j->own[y]++;
+		vm->tm[y >> 3] |= 1 << (y & 7);
+	}
+}
+
+static bool glyph_jit_stale(GlyphJit *j, Glyph *vm, u8 x) {
+	for (int i = 0; i < j->n[x]; i++)
+		if (vm->m[(u8)(x + i)] != j->src[x][i])
+			return true;
+	return false;
+}
+
+/* Drop the block at x, counting the bytes that changed under it. */
+static void glyph_jit_forget(GlyphJit *j, Glyph *vm, u8 x) {
+	j->blk[x] = NULL;
+	for (int i = 0; i < j->n[x]; i++) {
+		u8 y = x + i;
+		if (vm->m[y] != j->src[x][i] && j->hot[y] < 255)
+			j->hot[y]++;
+		if (!--j->own[y])
+			vm->tm[y >> 3] &= ~(1 << (y & 7));
+	}
+}
+
+static void glyph_jit_seen(GlyphJit *j, Glyph *vm) {
+	j->gen = vm->gen;
+	vm->tlo = SIZE - 1;
+	vm->thi = 0;
+}
+
+/* Drop the blocks whose bytes changed and rebuild vm->tm from the rest:
+ * on entry, where vm may not be the VM the blocks were made for. */
+static void glyph_jit_sweep(GlyphJit *j, Glyph *vm) {
+	memset(vm->tm, 0, sizeof(vm->tm));
+	memset(j->own, 0, sizeof(j->own));
+	for (int x = 0; x < SIZE; x++) {
+		if (!j->blk[x]) continue;
+		if (glyph_jit_stale(j, vm, x))
+			j->blk[x] = NULL;
+		else
+			glyph_jit_mark(j, vm, x);
+	}
+	glyph_jit_seen(j, vm);
+}
+
+/* Drop the blocks over vm->tlo..thi whose bytes changed. */
+static void glyph_jit_check(GlyphJit *j, Glyph *vm) {
+	int lo = vm->tlo, k = vm->thi - lo + GLYPH_JIT_SPAN;
+	if (lo > vm->thi)
+		k = 0;
+	else if (k > SIZE)
+		k = SIZE;
+	for (int i = 0; i < k; i++) {
+		u8 x = lo - GLYPH_JIT_SPAN + 1 + i;
+		if (j->blk[x] && glyph_jit_stale(j, vm, x))
+			glyph_jit_forget(j, vm, x);
+	}
+	glyph_jit_seen(j, vm);
+}
+
+static bool glyph_jit_hot(GlyphJit *j, u8 x, int len) {
+	for (int i = 0; i < len; i++)
+		if (j->hot[(u8)(x + i)] >= GLYPH_JIT_HOT)
+			return true;
+	return false;
+}
+
+/* W^X over the pages one block can be written to from at. */
+static int glyph_jit_protect(GlyphJit *j, u8 *at, int prot) {
+	uintptr_t lo = (uintptr_t)at & ~(uintptr_t)(GLYPH_JIT_PAGE - 1);
+	uintptr_t hi = (uintptr_t)at + GLYPH_JIT_MAX + GLYPH_JIT_PAGE - 1;
+	hi &= ~(uintptr_t)(GLYPH_JIT_PAGE - 1);
+	if (hi > (uintptr_t)(j->code + GLYPH_JIT_CODE))
+		hi = (uintptr_t)(j->code + GLYPH_JIT_CODE);
+	return mprotect((void *)lo, hi - lo, prot);
+}
+
+/* Translate one rune; returns the offset of the next one, or -1 once the
+ * block has been closed. */
+static int glyph_jit_rune(GlyphJit *j, JxAcc *s, const GlyphOp *d, u8 x, int o) {
+	u8 *p, *q;
+	switch (d->k) {
+	case GD_NOP: jx_set(s, 0); break;
+	case GD_IMM:
+		if (s->kn) {
+			jx_set(s, s->kv * d->mul + d->add);
+			break;
+		}
+		jx_rex(j, JX_ACC, 0, JX_ACC); jx_b(j, 0x69);	/* imul r12d, r12d, mul */
+		jx_b(j, 0xe4); jx_d(j, d->mul);
+		jx_rex(j, 0, 0, JX_ACC); jx_b(j, 0x81);	/* add r12d, add */
+		jx_b(j, 0xc4); jx_d(j, d->add);
+		jx_acc(j, s, JX_ACC);
+		break;
+	case GD_STO:
+		if (s->kn) jx_sti(j, JX_R(d->a), s->kv);
+		else jx_st(j, JX_ACC, JX_R(d->a));
+		jx_set(s, 0);
+		break;
+	case GD_JMP:
+		if (s->kn) {
+			u8 pc = s->kv;
+			jx_set(s, 0);
+			jx_exit(j, s, pc);
+		} else {
+			jx_rr(j, 0x89, JX_AX, JX_ACC);
+			jx_set(s, 0);
+			jx_exit_ax(j, s);
+		}
+		return -1;
+	case GD_LIT: jx_set(s, d->a); break;
+	case GD_ADD: case GD_SUB: case GD_MUL: case GD_AND: case GD_OR:
+	case GD_XOR: {
+		static const u8 op[] = {
+			[GD_ADD - GD_ADD] = 0x01, [GD_SUB - GD_ADD] = 0x29,
+			[GD_AND - GD_ADD] = 0x21, [GD_OR - GD_ADD] = 0x09,
+			[GD_XOR - GD_ADD] = 0x31,
+		};
+		jx_ld(j, JX_AX, JX_R(d->a));
+		jx_ld(j, JX_CX, JX_R(d->b));
+		if (d->k == GD_MUL) {
+			jx_b(j, 0x0f); jx_b(j, 0xaf); jx_b(j, 0xc1);	/* imul eax, ecx */
+		} else {
+			jx_rr(j, op[d->k - GD_ADD], JX_AX, JX_CX);
+		}
+		jx_acc(j, s, JX_AX);
+	} break;
+	case GD_DIV: case GD_MOD:
+		jx_ld(j, JX_AX, JX_R(d->a));
+		jx_ld(j, JX_CX, JX_R(d->b));
+		jx_rr(j, 0x85, JX_CX, JX_CX);
+		p = jx_jcc(j, JX_E);
+		jx_rr(j, 0x31, JX_DX, JX_DX);
+		jx_b(j, 0xf7); jx_b(j, 0xf1);	/* div ecx */
+		if (d->k == GD_MOD) jx_rr(j, 0x89, JX_AX, JX_DX);
+		q = jx_jmp(j);
+		jx_land(j, p);
+		jx_rr(j, 0x31, JX_AX, JX_AX);
+		jx_land(j, q);
+		jx_acc(j, s, JX_AX);
+		break;
+	case GD_SHL: case GD_SHR:
+		if (s->kn && s->kv > 7) {
+			jx_set(s, 0);
+			break;
+		}
+		jx_ld(j, JX_AX, JX_R(d->a));
+		if (s->kn) {
+			jx_b(j, 0xc1); jx_b(j, d->k == GD_SHL ? 0xe0 : 0xe8); jx_b(j, s->kv);
+			jx_acc(j, s, JX_AX);
+			break;
+		}
+		jx_rex(j, 0, 0, JX_ACC); jx_b(j, 0x83); jx_b(j, 0xfc); jx_b(j, 7);	/* cmp r12d, 7 */
+		p = jx_jcc(j, JX_A);
+		jx_rr(j, 0x89, JX_CX, JX_ACC);
+		jx_b(j, 0xd3); jx_b(j, d->k == GD_SHL ? 0xe0 : 0xe8);	/* shl/shr eax, cl */
+		q = jx_jmp(j);
+		jx_land(j, p);
+		jx_rr(j, 0x31, JX_AX, JX_AX);
+		jx_land(j, q);
+		jx_acc(j, s, JX_AX);
+		break;
+	case GD_NOT:
+		jx_ld(j, JX_AX, JX_R(d->a));
+		jx_b(j, 0xf7); jx_b(j, 0xd0);	/* not eax */
+		jx_acc(j, s, JX_AX);
+		break;
+	case GD_MLD:
+		if (s->kn) {
+			jx_ld(j, JX_AX, JX_M + s->kv);
+		} else {
+			jx_b(j, 0x42); jx_b(j, 0x0f); jx_b(j, 0xb6);	/* movzx eax, [rbx+r12+m] */
+			jx_b(j, 0x84); jx_b(j, 0x23); jx_d(j, JX_M);
+		}
+		jx_st(j, JX_AX, JX_R(d->b));
+		break;
+	case GD_MST:
+		/* '.' is synced first so a write into this block can return */
+		jx_sti(j, JX_R('.'), x + 3);
+		jx_sync(j, s);
+		jx_need(j, s);
+		jx_rr(j, 0x89, JX_SI, JX_ACC);
+		jx_ld(j, JX_DX, JX_R(d->b));
+		jx_call(j, (void *)glyph_jit_poke);
+		jx_rr(j, 0x85, JX_AX, JX_AX);
+		p = jx_jcc(j, JX_E);
+		jx_ret(j);
+		jx_land(j, p);
+		break;
+	case GD_PIN: case GD_POU:
+		jx_sti(j, JX_R('.'), x + 3);
+		jx_sync(j, s);
+		jx_b(j, 0xbe); jx_d(j, d->b);	/* mov esi, b */
+		jx_call(j, d->k == GD_PIN ? (void *)glyph_jit_in : (void *)glyph_jit_out);
+		jx_ret(j);
+		return -1;
+	case GD_CEQ: case GD_CNE: case GD_CLT: case GD_CGT: {
+		static const u8 cc[] = { JX_E, JX_NE, JX_B, JX_A };
+		jx_need(j, s);
+		jx_ld(j, JX_AX, JX_R(d->b));
+		jx_rr(j, 0x39, JX_ACC, JX_AX);
+		jx_b(j, 0x0f); jx_b(j, 0x90 | cc[d->k - GD_CEQ]); jx_b(j, 0xc0);	/* setcc al */
+		jx_zx(j, JX_FLG, JX_AX);
+	} break;
+	case GD_CMV: {
+		JxAcc f = *s;
+		jx_rr(j, 0x85, JX_FLG, JX_FLG);
+		p = jx_jcc(j, JX_NE);
+		jx_set(&f, 0);
+		jx_exit(j, &f, x + 1);
+		jx_land(j, p);
+		if (s->kn) jx_sti(j, JX_R(d->a), s->kv);
+		else jx_st(j, JX_ACC, JX_R(d->a));
+		jx_set(s, 0);
+		return o + 2;
+	}
+	case GD_CJP:
+		jx_need(j, s);
+		jx_rr(j, 0x85, JX_FLG, JX_FLG);
+		p = jx_jcc(j, JX_E);
+		jx_rr(j, 0x89, JX_AX, JX_ACC);
+		jx_set(s, 0);
+		jx_exit_ax(j, s);
+		jx_land(j, p);
+		return o + 1;
+	case GD_CAL:
+		jx_ld(j, JX_AX, JX_T);
+		jx_b(j, 0xc6); jx_b(j, 0x84); jx_b(j, 0x03); jx_d(j, JX_S);	/* s[T] = x+1 */
+		jx_b(j, x + 1);
+		jx_b(j, 0xff); jx_b(j, 0xc0);	/* inc eax */
+		jx_st(j, JX_AX, JX_T);
+		jx_ld(j, JX_AX, JX_R(d->a));
+		jx_exit_ax(j, s);
+		return -1;
+	case GD_CPY:
+		jx_ld(j, JX_AX, JX_R(d->b));
+		jx_st(j, JX_AX, JX_R(d->a));
+		break;
+	case GD_CPA:
+		jx_ld(j, JX_ACC, JX_R(d->b));
+		s->kn = 0; s->kr = 1;
+		break;
+	case GD_JPR:
+		jx_ld(j, JX_AX, JX_R(d->b));
+		jx_exit_ax(j, s);
+		return -1;
+	case GD_LBL: jx_sti(j, JX_R(d->a), x + 2); break;
+	case GD_SKP: break;
+	case GD_HLT:
+		jx_sti(j, JX_HALT, 1);
+		jx_exit(j, s, x + 1);
+		return -1;
+	}
+	return o + d->len;
+}
+
+static GlyphBlock glyph_jit_compile(GlyphJit *j, Glyph *vm, u8 x0) {
+	JxAcc s = { 0, 1, 0 };
+	GlyphOp d;
+	u8 *entry;
+	int o = 0, n = 0;
+	glyph_decode_rune(vm, x0, &d);
+	if (d.k == GD_SLW || glyph_jit_hot(j, x0, d.len))
+		return NULL;
+	if (j->at + GLYPH_JIT_MAX > j->code + GLYPH_JIT_CODE)
+		glyph_jit_reset(j, vm);
+	entry = j->at;
+	if (glyph_jit_protect(j, entry, PROT_READ | PROT_WRITE))
+		return NULL;
+	jx_b(j, 0x53); jx_b(j, 0x41); jx_b(j, 0x54); jx_b(j, 0x41); jx_b(j, 0x55);
+	jx_b(j, 0x48); jx_rr(j, 0x89, 3, 7);	/* mov rbx, rdi */
+	jx_ld(j, JX_ACC, JX_R('='));
+	jx_ld(j, JX_FLG, JX_R('?'));
+	for (;;) {
+		u8 x = x0 + o;
+		glyph_decode_rune(vm, x, &d);
+		if (d.k == GD_SLW || o + d.len > GLYPH_JIT_SPAN ||
+		    glyph_jit_hot(j, x, d.len)) {
+			jx_exit(j, &s, x);
+			break;
+		}
+		if (o + d.len > n)
+			n = o + d.len;
+		if ((o = glyph_jit_rune(j, &s, &d, x, o)) < 0)
+			break;
+	}
+	glyph_jit_protect(j, entry, PROT_READ | PROT_EXEC);
+	j->made++;
+	j->n[x0] = n;
+	for (int i = 0; i < n; i++)
+		j->src[x0][i] = vm->m[(u8)(x0 + i)];
+	glyph_jit_mark(j, vm, x0);
+	return j->blk[x0] = (GlyphBlock)(void *)entry;
+}
+
+GlyphJit *glyph_jit_new(void) {
+	GlyphJit *j = calloc(1, sizeof(*j));
+	if (!j) return NULL;
+	j->code = mmap(NULL, GLYPH_JIT_CODE, PROT_READ | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (j->code == MAP_FAILED) {
+		free(j);
+		return NULL;
+	}
+	j->at = j->code;
+	return j;
+}
+
+void glyph_jit_free(GlyphJit *j) {
+	if (!j) return;
+	munmap(j->code, GLYPH_JIT_CODE);
+	free(j);
+}
+
+void glyph_jit_run(GlyphJit *j, Glyph *vm) {
+	vm->wait = 0;
+	glyph_jit_sweep(j, vm);
+	while (!vm->halt && !vm->wait) {
+		GlyphBlock f;
+		if (vm->gen != j->gen)
+			glyph_jit_check(j, vm);
+		f = j->blk[vm->r['.']];
+		if (!f && !(f = glyph_jit_compile(j, vm, vm->r['.']))) {
+			glyph_step(vm);
+			continue;
+		}
+#ifdef GLYPH_TRACE
+		glyph_trace_here(vm);
+#endif
+		f(vm);
+	}
+}
+
+#undef JX_R
+#undef JX_M
+#undef JX_S
+#undef JX_T
+#undef JX_HALT
+#undef GLYPH_JIT_PAGE
+#undef GLYPH_JIT_MAX
+
+#else
+GlyphJit *glyph_jit_new(void) { return calloc(1, sizeof(GlyphJit)); }
+void glyph_jit_free(GlyphJit *j) { free(j); }
+void glyph_jit_run(GlyphJit *j, Glyph *vm) { (void)j; glyph_eval_decoded(vm); }
+#endif
+
+static pthread_key_t glyph_jit_key;
+static pthread_once_t glyph_jit_once = PTHREAD_ONCE_INIT;
+static _Thread_local int glyph_jit_depth;
+
+static void glyph_jit_drop(void *j) {
+	glyph_jit_free(j);
+}
+
+static void glyph_jit_key_new(void) {
+	pthread_key_create(&glyph_jit_key, glyph_jit_drop);
+}
+
+/* Runs on a translator kept per thread and freed when the thread exits,
+ * so a VM re-entered after a wait, or any other VM on the thread, starts
+ * with the blocks still in its void; glyph_jit_run sweeps out the rest.
+ * Blocks are keyed by address alone, so a call made from a callback of
+ * another gets a translator of its own: the outer VM would otherwise
+ * return to the inner one's blocks. */
+void glyph_eval_jit(Glyph *vm) {
+	bool nested = glyph_jit_depth > 0;
+	GlyphJit *j;
+	pthread_once(&glyph_jit_once, glyph_jit_key_new);
+	if (nested) {
+		j = glyph_jit_new();
+	} else if (!(j = pthread_getspecific(glyph_jit_key)) &&
+	    (j = glyph_jit_new())) {
+		pthread_setspecific(glyph_jit_key, j);
+	}
+	if (!j) {
+		glyph_eval_decoded(vm);
+		return;
+	}
+	glyph_jit_depth++;
+	glyph_jit_run(j, vm);
+	glyph_jit_depth--;
+	if (nested)
+		glyph_jit_free(j);
+}
+
+#endif /* GLYPH_IMPL */
+
+#endif /* GLYPH_JIT_H */
@@ -0,0 +1,139 @@
+/* GLYPH_LOAD - load a program from a file or a file descriptor. Usage:
+ * include after glyph.h in the GLYPH_IMPL file; POSIX only.
+ *
+ * A program is the bytes of the void from address 0, and one longer than
+ * the void does not load. Bytes are read straight into the void in as few
+ * reads as the source allows, so a pipe loads as it is written and
+ * nothing is staged in between. A wide build maps a regular file instead:
+ * the void becomes a private mapping of the file followed by zero pages
+ * up to the void's size, and pages are read in as the program touches
+ * them, so starting does not depend on the size of the file. As with
+ * glyph_adopt, the buffer given to glyph_init is then no longer used.
+ * The VM keeps the mapping: a later glyph_load replaces it and unmaps the
+ * old one, and glyph_unload releases it, before glyph_init or when the VM
+ * is done with.
+ */
+#ifndef GLYPH_LOAD_H
+#define GLYPH_LOAD_H
+
+#include "glyph.h"
+
+/* NULL once the program is in the void, else why it is not; a failed
+ * read may leave part of it there. */
+const char *glyph_load(Glyph *vm, const char *path);
+const char *glyph_load_fd(Glyph *vm, int fd);
+/* Unmap the void glyph_load mapped, if any; if vm runs in it, it has no
+ * void until it is given one. */
+void glyph_unload(Glyph *vm);
+
+/* ────────────────────────────────────────────────────────────────────────── */
+#ifdef GLYPH_IMPL
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS 0x20 /* hidden by -std=c11; fixed on Linux */
+#endif
+
+/* Read fd to its end into the void; one byte past it means too long.
+ * The caches are flushed whatever happens, as a failed read may already
+ * have written part of the void. */
+static const char *glyph_load_read(Glyph *vm, int fd) {
+	size_t len = 0, cap = GLYPH_VOID(vm);
+	const char *err = NULL;
+	u8 over;
+	for (;;) {
+		ssize_t n = len < cap ? read(fd, vm->m + len, cap - len) : read(fd, &over, 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			err = "cannot be read";
+			break;
+		}
+		if (n == 0) {
+			if (!len)
+				err = "is empty";
+			break;
+		}
+		if (len == cap) {
+			err = "does not fit in the void";
+			break;
+		}
+		len += n;
+	}
+	glyph_flush(vm);
+	return err;
+}
+
+#if GLYPH_BITS > 8
+/* The void as zero pages with the len bytes of fd mapped over the start;
+ * past the end of the file its last page reads as zeros. */
+static const char *glyph_load_map(Glyph *vm, int fd, size_t len) {
+	size_t cap = GLYPH_VOID(vm);
+	u8 *m = mmap(NULL, cap, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (m == MAP_FAILED)
+		return "cannot be mapped";
+	if (mmap(m, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+	    fd, 0) == MAP_FAILED) {
+		munmap(m, cap);
+		return "cannot be mapped";
+	}
+	glyph_unload(vm);
+	vm->m = vm->map = m;
+	vm->map_size = cap;
+	return NULL;
+}
+#endif
+
+void glyph_unload(Glyph *vm) {
+#if GLYPH_BITS > 8
+	if (!vm->map)
+		return;
+	if (vm->m == vm->map)
+		vm->m = NULL;
+	munmap(vm->map, vm->map_size);
+	vm->map = NULL;
+#else
+	(void)vm;
+#endif
+}
+
+/* Everything is loaded from fd's offset on. A regular file is checked for
+ * size before anything is read; in a wide build one read from its start
+ * is mapped whole, as mappings begin on a page. Anything else is read
+ * from where it is. */
+const char *glyph_load_fd(Glyph *vm, int fd) {
+	struct stat st;
+	off_t at;
+	if (fstat(fd, &st) < 0)
+		return "cannot be read";
+	if (S_ISREG(st.st_mode)) {
+		if ((at = lseek(fd, 0, SEEK_CUR)) < 0)
+			return "cannot be read";
+		if (st.st_size <= at)
+			return "is empty";
+		if ((uint64_t)(st.st_size - at) > GLYPH_VOID(vm))
+			return "does not fit in the void";
+#if GLYPH_BITS > 8
+		if (at == 0)
+			return glyph_load_map(vm, fd, st.st_size);
+#endif
+	}
+	return glyph_load_read(vm, fd);
+}
+
+const char *glyph_load(Glyph *vm, const char *path) {
+	const char *err;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return "cannot be opened";
+	err = glyph_load_fd(vm, fd);
+	close(fd);
+	return err;
+}
+
+#endif /* GLYPH_IMPL */
+#endif /* GLYPH_LOAD_H */
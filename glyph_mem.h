@@ -0,0 +1,150 @@
+/* GLYPH_MEM - a memory controller: block copy, fill, compare and search
+ * over the void in one resonance. Usage: include after glyph.h in the
+ * GLYPH_IMPL file and put glyph_mem in a device's emit table at
+ * GLYPH_MEM_PORT; it does not use the device's context.
+ *
+ * A program writes the operands to their ports, then a command to 'M',
+ * and hears the result on 'M':
+ *   'T'  to: the first address written or compared, or the set
+ *   'F'  from: the first address read or searched, or the fill byte
+ *   'L'  length in bytes
+ *   'N'  needle: the byte searched for, or how many bytes the set has
+ *   'M'  'c' copies L bytes from F to T as memmove does; 'f' fills L
+ *        bytes from T with the low byte of F. Both leave the count
+ *        written. '=' compares L bytes from T with L bytes from F and
+ *        leaves 0 if they are the same, else 1 or -1 as the first byte
+ *        that differs is larger at T or at F. 's' searches the L bytes
+ *        from F for the low byte of N, 'a' for any of the N bytes from
+ *        T; both leave the offset from F of the first byte found, or the
+ *        count searched if there is none. Other commands are ignored.
+ *
+ *   'T#>t 'F#>f 'L#>n 'c=k 'M#>k    copy n bytes from f to t
+ *   'F#>f 'L#>n 10=c 'N#>c 's=k 'M#>k 'M#<i    the next line is at f + i
+ *
+ * Ranges do not wrap: one that runs past the end of the void is cut
+ * there. The work is done by the host's memmove, memset, memcmp and
+ * memchr, vector loops in any libc worth the name, and the bytes written
+ * go to glyph_dirty so every engine re-reads them. 'a' compares a whole
+ * vector with each byte of a set of up to GLYPH_MEM_SET (16) on SSE2 or
+ * AVX2, and looks larger sets up in a bitmap a byte at a time.
+ */
+#ifndef GLYPH_MEM_H
+#define GLYPH_MEM_H
+
+#include "glyph.h"
+
+#ifndef GLYPH_MEM_PORT
+#define GLYPH_MEM_PORT 'M'
+#endif
+#define GLYPH_MEM_TO   'T'
+#define GLYPH_MEM_FROM 'F'
+#define GLYPH_MEM_LEN  'L'
+#define GLYPH_MEM_NEEDLE 'N'
+#define GLYPH_MEM_SET  16	/* largest set 'a' searches for by vector */
+
+void glyph_mem(Glyph *vm, void *ctx, u8 p);
+
+/* ────────────────────────────────────────────────────────────────────────── */
+#ifdef GLYPH_IMPL
+
+/* n, or as much of it as fits between x and the end of the void */
+static uint32_t glyph_mem_cut(Glyph *vm, uint32_t x, uint32_t n) {
+	uint32_t room = GLYPH_VOID(vm) - x;
+	return n < room ? n : room;
+}
+
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define GLYPH_MEM_VEC 32
+typedef __m256i GlyphMemVec;
+#define GM_LD(s) _mm256_loadu_si256((const __m256i *)(s))
+#define GM_DUP(c) _mm256_set1_epi8((char)(c))
+#define GM_EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define GM_OR(a, b) _mm256_or_si256(a, b)
+#define GM_BITS(v) (uint32_t)_mm256_movemask_epi8(v)
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define GLYPH_MEM_VEC 16
+typedef __m128i GlyphMemVec;
+#define GM_LD(s) _mm_loadu_si128((const __m128i *)(s))
+#define GM_DUP(c) _mm_set1_epi8((char)(c))
+#define GM_EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define GM_OR(a, b) _mm_or_si128(a, b)
+#define GM_BITS(v) (uint32_t)_mm_movemask_epi8(v)
+#endif
+
+/* Offset of the first of the n bytes at s that is one of the k at set,
+ * or n. Whole vectors are compared with each byte of a small set; the
+ * tail, and everything for a large set, goes through a bitmap. */
+static uint32_t glyph_mem_any(const u8 *s, uint32_t n, const u8 *set, uint32_t k) {
+	u8 in[SIZE / 8] = {0};
+	uint32_t i = 0;
+	if (!k)
+		return n;
+#ifdef GLYPH_MEM_VEC
+	if (k <= GLYPH_MEM_SET) {
+		GlyphMemVec dup[GLYPH_MEM_SET];
+		for (uint32_t j = 0; j < k; j++)
+			dup[j] = GM_DUP(set[j]);
+		for (; i + GLYPH_MEM_VEC <= n; i += GLYPH_MEM_VEC) {
+			GlyphMemVec v = GM_LD(s + i), hit = GM_EQ(v, dup[0]);
+			uint32_t m;
+			for (uint32_t j = 1; j < k; j++)
+				hit = GM_OR(hit, GM_EQ(v, dup[j]));
+			if ((m = GM_BITS(hit)))
+				return i + __builtin_ctz(m);
+		}
+	}
+#endif
+	for (uint32_t j = 0; j < k; j++)
+		in[set[j] >> 3] |= 1 << (set[j] & 7);
+	for (; i < n; i++)
+		if (in[s[i] >> 3] >> (s[i] & 7) & 1)
+			return i;
+	return n;
+}
+
+void glyph_mem(Glyph *vm, void *ctx, u8 p) {
+	uint32_t to = vm->p[GLYPH_MEM_TO] & (GLYPH_VOID(vm) - 1);
+	uint32_t from = vm->p[GLYPH_MEM_FROM] & (GLYPH_VOID(vm) - 1);
+	uint32_t n = glyph_mem_cut(vm, to, vm->p[GLYPH_MEM_LEN]);
+	const u8 *at;
+	int d;
+	(void)ctx;
+	switch (vm->p[p]) {
+	case 'c':
+		n = glyph_mem_cut(vm, from, n);
+		memmove(vm->m + to, vm->m + from, n);
+		glyph_dirty(vm, to, n);
+		vm->p[p] = n;
+		break;
+	case 'f':
+		memset(vm->m + to, (u8)vm->p[GLYPH_MEM_FROM], n);
+		glyph_dirty(vm, to, n);
+		vm->p[p] = n;
+		break;
+	case '=':
+		d = memcmp(vm->m + to, vm->m + from, glyph_mem_cut(vm, from, n));
+		vm->p[p] = d < 0 ? (GlyphWord)-1 : d > 0;
+		break;
+	case 's':
+		n = glyph_mem_cut(vm, from, vm->p[GLYPH_MEM_LEN]);
+		at = memchr(vm->m + from, (u8)vm->p[GLYPH_MEM_NEEDLE], n);
+		vm->p[p] = at ? (uint32_t)(at - (vm->m + from)) : n;
+		break;
+	case 'a':
+		n = glyph_mem_cut(vm, from, vm->p[GLYPH_MEM_LEN]);
+		vm->p[p] = glyph_mem_any(vm->m + from, n, vm->m + to,
+			glyph_mem_cut(vm, to, vm->p[GLYPH_MEM_NEEDLE]));
+		break;
+	}
+}
+
+#undef GM_LD
+#undef GM_DUP
+#undef GM_EQ
+#undef GM_OR
+#undef GM_BITS
+
+#endif /* GLYPH_IMPL */
+#endif /* GLYPH_MEM_H */
@@ -0,0 +1,152 @@
+/* GLYPH_REPLAY - record what a VM hears and play it back. Usage: include
+ * after glyph.h in the GLYPH_IMPL file.
+ *
+ * Everything a run does not decide for itself comes in through '#<', so a
+ * log of the values heard replays the run exactly, on any engine, without
+ * the devices that produced them. Emits still go to the VM's own device:
+ * the output of a replay can be diffed against the recorded run's.
+ *
+ * The log is "GLYR", version, GLYPH_BITS, 2 zero bytes, then a record
+ * per hear: the port, then '.' after the '#<' and the value heard as
+ * little-endian base-128 varints. A hear the callback left waiting is
+ * not recorded; the rerun of the '#<' is. The '.' is the check that the
+ * replay follows the run: the engines do not count runes.
+ */
+#ifndef GLYPH_REPLAY_H
+#define GLYPH_REPLAY_H
+
+#include "glyph.h"
+
+#define GLYPH_REPLAY_VERSION 1
+
+typedef struct {
+	FILE *f;
+	bool play;
+	const char *err;	/* why a replay stopped the VM */
+	uint64_t events;	/* hears recorded or replayed */
+	/* the VM's own resonance, restored by glyph_replay_end */
+	R e, h;
+	const GlyphDevice *dev;
+	void *ctx;
+} GlyphReplay;
+
+/* Both take over vm's resonance until glyph_replay_end; false on a write
+ * error or a log that is not from this build. A replay that runs off its
+ * log or out of step with it halts the VM and says why in rp->err. */
+bool glyph_record(Glyph *vm, GlyphReplay *rp, FILE *f);
+bool glyph_replay(Glyph *vm, GlyphReplay *rp, FILE *f);
+bool glyph_replay_end(Glyph *vm, GlyphReplay *rp);
+
+/* ────────────────────────────────────────────────────────────────────────── */
+#ifdef GLYPH_IMPL
+
+static void glyph_rp_put(FILE *f, uint64_t v) {
+	for (; v >= 0x80; v >>= 7)
+		fputc((int)(v & 0x7F) | 0x80, f);
+	fputc((int)v, f);
+}
+
+static bool glyph_rp_get(FILE *f, uint64_t *v) {
+	int c, sh = 0;
+	*v = 0;
+	do {
+		if ((c = fgetc(f)) == EOF || sh > 63)
+			return false;
+		*v |= (uint64_t)(c & 0x7F) << sh;
+		sh += 7;
+	} while (c & 0x80);
+	return true;
+}
+
+/* Run the VM's own callback with its own device and context. */
+static void glyph_rp_call(Glyph *vm, GlyphReplay *rp, R f, u8 p) {
+	if (!f) return;
+	vm->dev = rp->dev;
+	vm->ctx = rp->ctx;
+	f(vm, p);
+	rp->dev = vm->dev;
+	rp->ctx = vm->ctx;
+	vm->dev = NULL;
+	vm->ctx = rp;
+}
+
+static void glyph_rp_emit(Glyph *vm, u8 p) {
+	GlyphReplay *rp = vm->ctx;
+	glyph_rp_call(vm, rp, rp->e, p);
+}
+
+static void glyph_rp_hear(Glyph *vm, u8 p) {
+	GlyphReplay *rp = vm->ctx;
+	glyph_rp_call(vm, rp, rp->h, p);
+	if (vm->wait)
+		return;
+	fputc(p, rp->f);
+	glyph_rp_put(rp->f, vm->r['.']);
+	glyph_rp_put(rp->f, vm->p[p]);
+	rp->events++;
+}
+
+static void glyph_rp_play(Glyph *vm, u8 p) {
+	GlyphReplay *rp = vm->ctx;
+	uint64_t pc, v;
+	int c = fgetc(rp->f);
+	if (c == EOF) {
+		rp->err = "the log ends here";
+	} else if (c != p || !glyph_rp_get(rp->f, &pc) || !glyph_rp_get(rp->f, &v)) {
+		rp->err = "the log hears another port here";
+	} else if (pc != (GlyphWord)vm->r['.']) {
+		rp->err = "the log hears at another address";
+	} else {
+		vm->p[p] = (GlyphWord)v;
+		rp->events++;
+		return;
+	}
+	vm->p[p] = 0;
+	vm->halt = 1;
+}
+
+static void glyph_rp_begin(Glyph *vm, GlyphReplay *rp, FILE *f, bool play) {
+	memset(rp, 0, sizeof(*rp));
+	rp->f = f;
+	rp->play = play;
+	rp->e = vm->e;
+	rp->h = vm->h;
+	rp->dev = vm->dev;
+	rp->ctx = vm->ctx;
+	vm->e = glyph_rp_emit;
+	vm->h = play ? glyph_rp_play : glyph_rp_hear;
+	vm->dev = NULL;
+	vm->ctx = rp;
+}
+
+bool glyph_record(Glyph *vm, GlyphReplay *rp, FILE *f) {
+	u8 head[8] = "GLYR";
+	head[4] = GLYPH_REPLAY_VERSION;
+	head[5] = GLYPH_BITS;
+	if (fwrite(head, 1, sizeof(head), f) != sizeof(head))
+		return false;
+	glyph_rp_begin(vm, rp, f, false);
+	return true;
+}
+
+bool glyph_replay(Glyph *vm, GlyphReplay *rp, FILE *f) {
+	u8 head[8];
+	if (fread(head, 1, sizeof(head), f) != sizeof(head) ||
+	    memcmp(head, "GLYR", 4) || head[4] != GLYPH_REPLAY_VERSION ||
+	    head[5] != GLYPH_BITS)
+		return false;
+	glyph_rp_begin(vm, rp, f, true);
+	return true;
+}
+
+/* Give vm its resonance back; false if the record could not be written. */
+bool glyph_replay_end(Glyph *vm, GlyphReplay *rp) {
+	vm->e = rp->e;
+	vm->h = rp->h;
+	vm->dev = rp->dev;
+	vm->ctx = rp->ctx;
+	return rp->play || (!fflush(rp->f) && !ferror(rp->f));
+}
+
+#endif /* GLYPH_IMPL */
+#endif /* GLYPH_REPLAY_H */
@@ -0,0 +1,280 @@
+/* GLYPH_SCHED - run many VMs on a pool of worker threads (pthreads, C11
+ * atomics). Usage: include after glyph.h in the GLYPH_IMPL file and link
+ * with -pthread.
+ *
+ * A task is a Glyph plus scheduler state; callbacks get the Glyph, which
+ * is the first member, so (GlyphTask *)vm recovers the task. Each worker
+ * owns a Chase-Lev deque of runnable tasks and runs one for a slice of
+ * glyph_step_n. A task out of budget goes back on its worker's deque; an
+ * idle worker steals from the others. Workers take from the top of their
+ * own deque as well, so the tasks on it are served round-robin.
+ *
+ * A hear callback with no input sets vm->wait and the task is parked off
+ * every queue until glyph_sched_wake, which may be called from any
+ * thread, including before the park lands.
+ */
+#ifndef GLYPH_SCHED_H
+#define GLYPH_SCHED_H
+
+#include "glyph.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define GLYPH_SCHED_SLICE 10000	/* runes per turn */
+#define GLYPH_SCHED_DEQUE 1024	/* per worker; overflow goes to the inbox */
+
+typedef struct GlyphTask GlyphTask;
+struct GlyphTask {
+	Glyph vm;
+	void *arg;
+	_Atomic int state;
+	GlyphTask *next;	/* inbox link */
+};
+
+typedef struct GlyphSched GlyphSched;
+
+/* done runs on a worker once a task halts; it may free the task. */
+GlyphSched *glyph_sched_new(int workers, void (*done)(GlyphTask *t));
+void glyph_sched_add(GlyphSched *s, GlyphTask *t);
+void glyph_sched_wake(GlyphSched *s, GlyphTask *t);
+void glyph_sched_drain(GlyphSched *s);
+void glyph_sched_free(GlyphSched *s);
+
+/* ────────────────────────────────────────────────────────────────────────── */
+#ifdef GLYPH_IMPL
+
+#include <stdlib.h>
+
+enum { GS_RUN, GS_PARK, GS_WOKE, GS_DONE };
+
+typedef struct {
+	_Atomic long top, bot;
+	_Atomic(GlyphTask *) buf[GLYPH_SCHED_DEQUE];
+} GlyphDeque;
+
+typedef struct {
+	GlyphSched *s;
+	GlyphDeque q;
+	pthread_t th;
+	unsigned seed;
+} GlyphWorker;
+
+struct GlyphSched {
+	GlyphWorker *w;
+	int n, up;	/* workers, threads started */
+	void (*done)(GlyphTask *t);
+	pthread_mutex_t lock;
+	pthread_cond_t wake, drained;
+	GlyphTask *in, *in_tail;	/* inbox, under lock */
+	_Atomic int in_n, idle, live;
+	_Atomic bool stop;
+};
+
+/* Owner only. False when full. */
+static bool glyph_deque_push(GlyphDeque *q, GlyphTask *t) {
+	long b = atomic_load_explicit(&q->bot, memory_order_relaxed);
+	long top = atomic_load_explicit(&q->top, memory_order_acquire);
+	if (b - top >= GLYPH_SCHED_DEQUE)
+		return false;
+	atomic_store_explicit(&q->buf[b % GLYPH_SCHED_DEQUE], t, memory_order_relaxed);
+	atomic_store_explicit(&q->bot, b + 1, memory_order_release);
+	return true;
+}
+
+/* Any thread, the owner included. */
+static GlyphTask *glyph_deque_steal(GlyphDeque *q) {
+	for (;;) {
+		long top = atomic_load_explicit(&q->top, memory_order_acquire);
+		atomic_thread_fence(memory_order_seq_cst);
+		long b = atomic_load_explicit(&q->bot, memory_order_acquire);
+		if (top >= b)
+			return NULL;
+		GlyphTask *t = atomic_load_explicit(&q->buf[top % GLYPH_SCHED_DEQUE],
+			memory_order_relaxed);
+		if (atomic_compare_exchange_strong_explicit(&q->top, &top, top + 1,
+		    memory_order_seq_cst, memory_order_relaxed))
+			return t;
+	}
+}
+
+static void glyph_sched_signal(GlyphSched *s) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&s->idle)) {
+		pthread_mutex_lock(&s->lock);
+		pthread_cond_signal(&s->wake);
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+static void glyph_sched_post(GlyphSched *s, GlyphTask *t) {
+	pthread_mutex_lock(&s->lock);
+	t->next = NULL;
+	if (s->in) s->in_tail->next = t;
+	else s->in = t;
+	s->in_tail = t;
+	atomic_fetch_add(&s->in_n, 1);
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static GlyphTask *glyph_sched_inbox(GlyphSched *s) {
+	GlyphTask *t;
+	if (!atomic_load(&s->in_n))
+		return NULL;
+	pthread_mutex_lock(&s->lock);
+	if ((t = s->in)) {
+		s->in = t->next;
+		atomic_fetch_sub(&s->in_n, 1);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return t;
+}
+
+static GlyphTask *glyph_sched_find(GlyphSched *s, GlyphWorker *w) {
+	GlyphTask *t;
+	if ((t = glyph_deque_steal(&w->q)) || (t = glyph_sched_inbox(s)))
+		return t;
+	w->seed = w->seed * 1103515245 + 12345;
+	for (int i = 0, v = (w->seed >> 16) % s->n; i < s->n; i++, v = (v + 1) % s->n)
+		if (&s->w[v] != w && (t = glyph_deque_steal(&s->w[v].q)))
+			return t;
+	return NULL;
+}
+
+static bool glyph_sched_any(GlyphSched *s) {
+	if (atomic_load(&s->in_n))
+		return true;
+	for (int i = 0; i < s->n; i++)
+		if (atomic_load(&s->w[i].q.top) < atomic_load(&s->w[i].q.bot))
+			return true;
+	return false;
+}
+
+static void glyph_sched_requeue(GlyphSched *s, GlyphWorker *w, GlyphTask *t) {
+	if (!glyph_deque_push(&w->q, t)) {
+		glyph_sched_post(s, t);
+		return;
+	}
+	glyph_sched_signal(s);
+}
+
+static void glyph_sched_turn(GlyphSched *s, GlyphWorker *w, GlyphTask *t) {
+	int st = GS_RUN;
+	switch (glyph_step_n(&t->vm, GLYPH_SCHED_SLICE)) {
+	case GLYPH_BUDGET:
+		glyph_sched_requeue(s, w, t);
+		break;
+	case GLYPH_WAIT:
+		/* a wake that came while running leaves GS_WOKE: go again */
+		if (!atomic_compare_exchange_strong(&t->state, &st, GS_PARK)) {
+			atomic_store(&t->state, GS_RUN);
+			glyph_sched_requeue(s, w, t);
+		}
+		break;
+	case GLYPH_HALT:
+		atomic_store(&t->state, GS_DONE);
+		if (s->done) s->done(t);
+		if (atomic_fetch_sub(&s->live, 1) == 1) {
+			pthread_mutex_lock(&s->lock);
+			pthread_cond_broadcast(&s->drained);
+			pthread_mutex_unlock(&s->lock);
+		}
+		break;
+	}
+}
+
+static void *glyph_sched_worker(void *arg) {
+	GlyphWorker *w = arg;
+	GlyphSched *s = w->s;
+	while (!atomic_load(&s->stop)) {
+		GlyphTask *t = glyph_sched_find(s, w);
+		if (t) {
+			glyph_sched_turn(s, w, t);
+			continue;
+		}
+		/* idle is raised before the last look, so a push that missed it
+		 * is seen here, and one that saw it signals under the lock */
+		pthread_mutex_lock(&s->lock);
+		atomic_fetch_add(&s->idle, 1);
+		while (!atomic_load(&s->stop) && !glyph_sched_any(s))
+			pthread_cond_wait(&s->wake, &s->lock);
+		atomic_fetch_sub(&s->idle, 1);
+		pthread_mutex_unlock(&s->lock);
+	}
+	return NULL;
+}
+
+GlyphSched *glyph_sched_new(int workers, void (*done)(GlyphTask *t)) {
+	GlyphSched *s = calloc(1, sizeof(*s));
+	if (!s) return NULL;
+	if (workers < 1) workers = 1;
+	if (!(s->w = calloc(workers, sizeof(*s->w)))) {
+		free(s);
+		return NULL;
+	}
+	s->done = done;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+	pthread_cond_init(&s->drained, NULL);
+	s->n = workers;
+	for (int i = 0; i < workers; i++) {
+		s->w[i].s = s;
+		s->w[i].seed = i + 1;
+	}
+	for (; s->up < workers; s->up++)
+		if (pthread_create(&s->w[s->up].th, NULL, glyph_sched_worker, &s->w[s->up])) {
+			glyph_sched_free(s);
+			return NULL;
+		}
+	return s;
+}
+
+void glyph_sched_add(GlyphSched *s, GlyphTask *t) {
+	atomic_store(&t->state, GS_RUN);
+	atomic_fetch_add(&s->live, 1);
+	glyph_sched_post(s, t);
+}
+
+void glyph_sched_wake(GlyphSched *s, GlyphTask *t) {
+	int st = atomic_load(&t->state);
+	for (;;) {
+		if (st == GS_PARK) {
+			if (atomic_compare_exchange_weak(&t->state, &st, GS_RUN)) {
+				glyph_sched_post(s, t);
+				return;
+			}
+		} else if (st == GS_RUN) {
+			if (atomic_compare_exchange_weak(&t->state, &st, GS_WOKE))
+				return;
+		} else {
+			return;
+		}
+	}
+}
+
+/* Wait until every task added so far has halted. */
+void glyph_sched_drain(GlyphSched *s) {
+	pthread_mutex_lock(&s->lock);
+	while (atomic_load(&s->live))
+		pthread_cond_wait(&s->drained, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* Stops the workers; tasks still queued or parked are left as they are. */
+void glyph_sched_free(GlyphSched *s) {
+	if (!s) return;
+	pthread_mutex_lock(&s->lock);
+	atomic_store(&s->stop, true);
+	pthread_cond_broadcast(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	for (int i = 0; i < s->up; i++)
+		pthread_join(s->w[i].th, NULL);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->wake);
+	pthread_cond_destroy(&s->drained);
+	free(s->w);
+	free(s);
+}
+
+#endif /* GLYPH_IMPL */
+#endif /* GLYPH_SCHED_H */
@@ -7,100 +7,514 @@
  *   'c' console input and output.
  *   'e' stderr output.
  *
+ * Memory Device (see glyph_mem.h):
+ *   'M' block copy, fill, compare and byte search over the void, with
+ *       'T', 'F', 'L' and 'N'.
+ *
  * System:
  *   'X' (88)  - exit:   exit with code
+ *   'S' (83)  - barrier: with -S, write the VM to an image and exit;
+ *               with -F, serve forks of the VM from here
  *
- * Usage: ./glyph <program.glyph> [args...]
- *		./glyph -e "<code>"
+ * Usage: ./glyph [-b|-u] [-p] [-t file] [-r|-R log] [-S image] <program.glyph> [args...]
+ *		./glyph [-b|-u] [-p] [-S image] -e "<code>"
+ *		./glyph [-b|-u] [-p] -i image
+ *		./glyph [-p] -F socket <program.glyph>
  *		echo "input" | ./glyph program.glyph
+ *
+ * Output to 'c' and 'e' is buffered (-b, the default when stdout is not a
+ * terminal) or written through per character (-u, the default on a
+ * terminal). Buffers are flushed when full, before waiting for input, on
+ * 'X' and on halt.
+ *
+ * The program is read into the void, or mapped as the void by a wide
+ * build (see glyph_load.h).
+ *
+ * Input to 'c' is mapped when stdin is a regular file and read in blocks
+ * otherwise; end of input reads as 0.
+ *
+ * -S runs a program up to its first emit on 'S' and saves the VM there
+ * (see glyph_snapshot); -i starts a VM from such an image, just after the
+ * emit, so a prologue is run once for many starts. Wide builds run in the
+ * mapped image itself, its pages copied only as they are written.
+ *
+ * -F makes a fork server: the program runs once up to its first emit on
+ * 'S', then every connection to the Unix socket gets a fork of the VM as
+ * it is there, which reads the connection as its input on 'c', writes its
+ * output back and closes it when it halts or exits. Clients shut down
+ * their side for writing once the input is sent. A socket left at the
+ * path is replaced; any other file there is an error.
+ *
+ * -r log records every value the program hears to log; -R log runs it
+ * again on those values instead of the console input (see glyph_replay.h),
+ * so a run can be repeated exactly and its output compared across engines.
+ *
+ * -t file (a build with -DGLYPH_TRACE, make glyph-trace) writes the last
+ * runes run to file at exit, for tools/glyphtrace; the decoded engine
+ * records a fused run as one rune and the JIT a block.
+ *
+ * -p (a build with -DGLYPH_PROFILE, make glyph-prof) reports on stderr at
+ * exit where the program spent its runes: by rune, address, call target
+ * and port, and a listing of the first 256 bytes with their counts.
  */
 
+#define _DEFAULT_SOURCE	/* lstat and S_ISSOCK under -std=c11 */
 #define GLYPH_IMPL
 #include "glyph.h"
+#include "glyph_replay.h"
+#include "glyph_load.h"
+#include "glyph_mem.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 /* Device prts */
 #define CON_CONSOLE 'c'   /* Read/Write to console */
 #define CON_ERROR   'e'   /* Write to stderr */
 #define SYS_EXIT	'X'   /* Exit code */
+#define SYS_SNAP	'S'   /* Snapshot for -S */
+#if GLYPH_BITS > 8
+#ifndef MEM_SIZE
+#define MEM_SIZE 0x10000  /* -DMEM_SIZE=... for a larger void */
+#endif
+static u8 mem[MEM_SIZE];
+#else
 #define MEM_SIZE 0x100
+#endif
+#define OUT_SIZE 0x10000
+#define IN_SIZE  0x10000
+
+/* Port output buffer for one file descriptor */
+typedef struct {
+	int fd;
+	size_t len;
+	char buf[OUT_SIZE];
+} Out;
 
-static Glyph vm;
+/* Console input: [p, end) is what is left of the mapping or the block */
+typedef struct {
+	const u8 *p, *end;
+	bool eof;
+	u8 buf[IN_SIZE];
+} In;
 
-/* Resonance out: handle prt writes */
-static void emu_emit(u8 prt) {
-	switch (prt) {
-	case CON_CONSOLE:
-		putchar(vm.p[CON_CONSOLE] & 0xFF);
-		fflush(stdout);
-		break;
-	case CON_ERROR:
-		fputc(vm.p[CON_ERROR] & 0xFF, stderr);
-		fflush(stderr);
-		break;
-	case SYS_EXIT:
-		exit(vm.p[SYS_EXIT] & 0xFF);
-		break;
+/* Everything the console device keeps for one VM */
+typedef struct {
+	Out out, err;
+	In in;
+	int in_fd;
+	bool buffered, profile;
+	const char *snap;	/* -S image */
+	const char *serve;	/* -F socket */
+	const char *trace;	/* -t file */
+} Console;
+
+static void out_flush(Out *o) {
+	size_t off = 0;
+	while (off < o->len) {
+		ssize_t n = write(o->fd, o->buf + off, o->len - off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
 	}
+	o->len = 0;
+}
+
+static void out_put(Console *c, Out *o, u8 ch) {
+	o->buf[o->len++] = ch;
+	if (!c->buffered || o->len == OUT_SIZE)
+		out_flush(o);
 }
 
-/* Resonance in: handle prt reads */
-static void emu_hear(u8 prt) {
-	switch (prt) {
-	case CON_CONSOLE: {
-		int ch = getchar();
-		vm.p[CON_CONSOLE] = (ch == EOF) ? 0 : (char)ch;
-	} break;
+static void flush_all(Console *c) {
+	out_flush(&c->out);
+	out_flush(&c->err);
+}
+
+/* Serve all of the input from one mapping when it is a regular file. */
+static void in_open(Console *c) {
+	struct stat st;
+	off_t at = lseek(c->in_fd, 0, SEEK_CUR);
+	if (fstat(c->in_fd, &st) || !S_ISREG(st.st_mode) || at < 0 ||
+	    st.st_size <= at)
+		return;
+	u8 *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, c->in_fd, 0);
+	if (map == MAP_FAILED)
+		return;
+	c->in.p = map + at;
+	c->in.end = map + st.st_size;
+	c->in.eof = true;
+}
+
+/* Next input byte, 0 at end of input. */
+static u8 in_get(Console *c) {
+	In *in = &c->in;
+	while (in->p == in->end) {
+		ssize_t n;
+		if (in->eof)
+			return 0;
+		flush_all(c);
+		n = read(c->in_fd, in->buf, IN_SIZE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			in->eof = true;
+			return 0;
+		}
+		in->p = in->buf;
+		in->end = in->buf + n;
 	}
+	return *in->p++;
 }
 
-/* Load program from file */
-static int load_file(const char *path) {
-	FILE *f = fopen(path, "rb");
-	if (!f) {
-		fprintf(stderr, "Error: cannot open '%s'\n", path);
+static void con_open(Console *c, int in_fd, int out_fd, int err_fd, bool buffered) {
+	c->out.fd = out_fd;
+	c->err.fd = err_fd;
+	c->in_fd = in_fd;
+	c->buffered = buffered;
+	c->in.p = c->in.end = NULL;
+	c->in.eof = false;
+	in_open(c);
+}
+
+/* Port handlers */
+static void con_write(Glyph *vm, void *ctx, u8 prt) {
+	Console *c = ctx;
+	out_put(c, &c->out, vm->p[prt]);
+}
+
+static void con_error(Glyph *vm, void *ctx, u8 prt) {
+	Console *c = ctx;
+	out_put(c, &c->err, vm->p[prt]);
+}
+
+static void con_read(Glyph *vm, void *ctx, u8 prt) {
+	vm->p[prt] = in_get(ctx);
+}
+
+#ifdef GLYPH_PROFILE
+static const uint64_t *prof_tab;
+
+static int prof_cmp(const void *a, const void *b) {
+	u8 x = *(const u8 *)a, y = *(const u8 *)b;
+	if (prof_tab[x] != prof_tab[y])
+		return prof_tab[x] < prof_tab[y] ? 1 : -1;
+	return x - y;
+}
+
+static const char *prof_name(u8 x, bool named) {
+	static char buf[8];
+	if (named && isgraph(x))
+		snprintf(buf, sizeof(buf), "'%c'", x);
+	else
+		snprintf(buf, sizeof(buf), "%d", x);
+	return buf;
+}
+
+/* The top entries of t, largest first; named tables print glyphs. */
+static void prof_top(const char *title, const uint64_t *t, int top, bool named) {
+	uint64_t total = 0;
+	u8 ix[SIZE];
+	for (int i = 0; i < SIZE; i++) {
+		ix[i] = i;
+		total += t[i];
+	}
+	if (!total)
+		return;
+	prof_tab = t;
+	qsort(ix, SIZE, 1, prof_cmp);
+	fprintf(stderr, "\n%s (%llu)\n", title, (unsigned long long)total);
+	for (int i = 0; i < top && t[ix[i]]; i++)
+		fprintf(stderr, "  %-6s %12llu %6.2f%%\n", prof_name(ix[i], named),
+			(unsigned long long)t[ix[i]], 100.0 * t[ix[i]] / total);
+}
+
+/* The void a line per executed address, running on to the next one. */
+static void prof_listing(Glyph *vm) {
+	int end = SIZE;
+	while (end > 0 && !vm->m[end - 1] && !vm->prof.at[end - 1])
+		end--;
+	fprintf(stderr, "\nlisting\n");
+	for (int x = 0; x < end;) {
+		if (vm->prof.at[x])
+			fprintf(stderr, "  %5d %12llu  ", x, (unsigned long long)vm->prof.at[x]);
+		else
+			fprintf(stderr, "  %5d %12s  ", x, "");
+		do {
+			u8 c = vm->m[x];
+			if (isprint(c)) fputc(c, stderr);
+			else fprintf(stderr, "\\x%02x", c);
+		} while (++x < end && !vm->prof.at[x]);
+		fputc('\n', stderr);
+	}
+}
+
+static void prof_report(Glyph *vm) {
+	prof_top("runes by rune", vm->prof.rune, SIZE, true);
+	prof_top("runes by address", vm->prof.at, 16, false);
+	prof_top("calls by target", vm->prof.call, 16, false);
+	prof_top("hears by port", vm->prof.in, 16, true);
+	prof_top("emits by port", vm->prof.out, 16, true);
+	prof_listing(vm);
+}
+#else
+static void prof_report(Glyph *vm) { (void)vm; }
+#endif
+
+#ifdef GLYPH_TRACE
+static void trace_save(Glyph *vm, Console *c) {
+	FILE *f = fopen(c->trace, "wb");
+	bool ok = f && glyph_trace_write(vm, f);
+	if (f && fclose(f)) ok = false;
+	if (!ok) fprintf(stderr, "Error: cannot write '%s'\n", c->trace);
+}
+#else
+static void trace_save(Glyph *vm, Console *c) { (void)vm; (void)c; }
+#endif
+
+static void sys_exit(Glyph *vm, void *ctx, u8 prt) {
+	Console *c = ctx;
+	flush_all(c);
+	if (c->profile) prof_report(vm);
+	if (c->trace) trace_save(vm, c);
+	exit(vm->p[prt] & 0xFF);
+}
+
+/* Write vm to path as a snapshot image */
+static int save_image(Glyph *vm, const char *path) {
+	size_t len = glyph_image_size(vm);
+	u8 *img = malloc(len);
+	FILE *f;
+	int ok;
+	if (!img || !(f = fopen(path, "wb"))) {
+		fprintf(stderr, "Error: cannot write '%s'\n", path);
+		free(img);
 		return -1;
 	}
-	size_t n = fread(vm.m, 1, MEM_SIZE, f);
-	fclose(f);
-	if (n == 0) {
-		fprintf(stderr, "Error: empty file '%s'\n", path);
+	glyph_snapshot(vm, img, len);
+	ok = fwrite(img, 1, len, f) == len;
+	ok &= fclose(f) == 0;
+	free(img);
+	if (!ok) {
+		fprintf(stderr, "Error: cannot write '%s'\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+/* Accept on path for good; returns only in a child, with the console
+ * moved onto its connection. */
+static void serve(Console *c, const char *path) {
+	struct sockaddr_un a = { .sun_family = AF_UNIX };
+	struct stat st;
+	int ls = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (strlen(path) >= sizeof(a.sun_path)) {
+		fprintf(stderr, "Error: socket path too long '%s'\n", path);
+		exit(1);
+	}
+	strcpy(a.sun_path, path);
+	if (!lstat(path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "Error: '%s' exists and is not a socket\n", path);
+			exit(1);
+		}
+		unlink(path);	/* a socket left by an earlier server */
+	}
+	if (ls < 0 || bind(ls, (struct sockaddr *)&a, sizeof(a)) || listen(ls, SOMAXCONN)) {
+		fprintf(stderr, "Error: cannot listen on '%s': %s\n", path, strerror(errno));
+		exit(1);
+	}
+	signal(SIGCHLD, SIG_IGN);	/* children are reaped by the kernel */
+	for (;;) {
+		int fd = accept(ls, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "Error: accept: %s\n", strerror(errno));
+			exit(1);
+		}
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(ls);
+			c->serve = c->snap = NULL;	/* a later 'S' is not ours */
+			con_open(c, fd, fd, STDERR_FILENO, true);
+			return;
+		}
+		if (pid < 0)
+			fprintf(stderr, "Error: fork: %s\n", strerror(errno));
+		close(fd);
+	}
+}
+
+static void sys_snap(Glyph *vm, void *ctx, u8 prt) {
+	Console *c = ctx;
+	(void)prt;
+	if (c->serve) {
+		flush_all(c);
+		serve(c, c->serve);
+	} else if (c->snap) {
+		flush_all(c);
+		exit(save_image(vm, c->snap) < 0);
+	}
+}
+
+static const GlyphDevice console = {
+	.emit = {
+		[CON_CONSOLE] = con_write,
+		[CON_ERROR]   = con_error,
+		[SYS_EXIT]    = sys_exit,
+		[SYS_SNAP]    = sys_snap,
+		[GLYPH_MEM_PORT] = glyph_mem,
+	},
+	.hear = {
+		[CON_CONSOLE] = con_read,
+	},
+};
+
+/* Load program from file */
+static int load_file(Glyph *vm, const char *path) {
+	const char *err = glyph_load(vm, path);
+	if (err) {
+		fprintf(stderr, "Error: '%s' %s\n", path, err);
 		return -1;
 	}
 	return 0;
 }
 
 /* Load program from string */
-static void load_string(const char *code) {
-	size_t len = strlen(code);
-	if (len > MEM_SIZE)
-		len = MEM_SIZE;
-	memcpy(vm.m, code, len);
+static int load_string(Glyph *vm, const char *code) {
+	if (!glyph_read(vm, code, strlen(code))) {
+		fprintf(stderr, "Error: code does not fit in %d bytes\n", MEM_SIZE);
+		return -1;
+	}
+	return 0;
+}
+
+/* Start from a snapshot image. The mapping is private: wide builds run
+ * in it and the kernel copies a page on its first write. */
+static int load_image(Glyph *vm, const char *path) {
+	struct stat st;
+	u8 *img = MAP_FAILED;
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0 && !fstat(fd, &st) && st.st_size > 0)
+		img = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (fd >= 0)
+		close(fd);
+	if (img == MAP_FAILED) {
+		fprintf(stderr, "Error: cannot open '%s'\n", path);
+		return -1;
+	}
+#if GLYPH_BITS > 8
+	if (glyph_adopt(vm, img, st.st_size))
+		return 0;
+#else
+	bool ok = glyph_restore(vm, img, st.st_size);
+	munmap(img, st.st_size);
+	if (ok)
+		return 0;
+#endif
+	fprintf(stderr, "Error: '%s' is not a %d-bit glyph image\n", path, GLYPH_BITS);
+	return -1;
 }
 
 static void usage(const char *prog) {
 	fprintf(stderr, "Glyph Console Emulator\n\n");
-	fprintf(stderr, "Usage: %s <program.glyph> [args...]\n", prog);
-	fprintf(stderr, "	   %s -e \"<code>\"\n\n", prog);
+	fprintf(stderr, "Usage: %s [-b|-u] [-p] [-t file] [-r|-R log] [-S image] <program.glyph> [args...]\n", prog);
+	fprintf(stderr, "	   %s [-b|-u] [-p] [-S image] -e \"<code>\"\n", prog);
+	fprintf(stderr, "	   %s [-b|-u] [-p] -i image\n", prog);
+	fprintf(stderr, "	   %s [-p] -F socket <program.glyph>\n\n", prog);
+	fprintf(stderr, "  -b  buffer port output (default unless stdout is a tty)\n");
+	fprintf(stderr, "  -u  write port output through per character\n");
+	fprintf(stderr, "  -p  report a profile on exit (-DGLYPH_PROFILE builds)\n");
+	fprintf(stderr, "  -t  write the last runes run to file on exit (-DGLYPH_TRACE builds)\n");
+	fprintf(stderr, "  -r  record every value heard to log\n");
+	fprintf(stderr, "  -R  hear the values in log instead of the console\n");
+	fprintf(stderr, "  -S  at the first emit on 'S', save the VM to image and exit\n");
+	fprintf(stderr, "  -i  start from an image saved by -S\n");
+	fprintf(stderr, "  -F  at the first emit on 'S', fork a copy of the VM per\n");
+	fprintf(stderr, "      connection to socket, with the connection as 'c'\n\n");
 	fprintf(stderr, "Console Device:\n");
 	fprintf(stderr, "  'c' (99)  - read/write: character\n");
 	fprintf(stderr, "  'e' (101) - error:  stderr\n");
 	fprintf(stderr, "\nSystem:\n");
 	fprintf(stderr, "  'X' (88)  - exit:   exit with code\n");
+	fprintf(stderr, "  'S' (83)  - barrier: -S saves and exits, -F serves\n");
 }
 
 int main(int argc, char **argv) {
+	static Glyph vm;
+	static Console con;
+	const char *prog = argv[0];
+	const char *snap = NULL, *sock = NULL, *trace = NULL;
+	const char *rec = NULL, *play = NULL;
+	bool buffered = !isatty(STDOUT_FILENO), profile = false;
+	FILE *log = NULL;
+	GlyphReplay rp;
+
+	for (; argc > 1 && argv[1][0] == '-' && argv[1][1] && !argv[1][2] &&
+	    strchr("bupSFtrR", argv[1][1]); argc--, argv++) {
+		const char **arg = NULL;
+		switch (argv[1][1]) {
+		case 'b': buffered = true; continue;
+		case 'u': buffered = false; continue;
+		case 'p': profile = true; continue;
+		case 'S': arg = &snap; break;
+		case 'F': arg = &sock; break;
+		case 't': arg = &trace; break;
+		case 'r': arg = &rec; break;
+		case 'R': arg = &play; break;
+		}
+		if (argc < 3) {
+			fprintf(stderr, "Error: %s requires an argument\n", argv[1]);
+			return 1;
+		}
+		*arg = argv[2];
+		argc--, argv++;
+	}
+#ifndef GLYPH_PROFILE
+	if (profile) {
+		fprintf(stderr, "Error: -p needs a build with -DGLYPH_PROFILE (make glyph-prof)\n");
+		return 1;
+	}
+#endif
+#ifndef GLYPH_TRACE
+	if (trace) {
+		fprintf(stderr, "Error: -t needs a build with -DGLYPH_TRACE (make glyph-trace)\n");
+		return 1;
+	}
+#endif
 	if (argc < 2) {
-		usage(argv[0]);
+		usage(prog);
+		return 1;
+	}
+	if (snap && sock) {
+		fprintf(stderr, "Error: -S and -F do not go together\n");
+		return 1;
+	}
+	if ((rec || play) && (sock || (rec && play))) {
+		fprintf(stderr, "Error: -r and -R go with neither -F nor each other\n");
 		return 1;
 	}
 
 	/* Initialize VM */
-	bzero(&vm, sizeof(vm));
-	vm.e = emu_emit;
-	vm.h = emu_hear;
+#if GLYPH_BITS > 8
+	glyph_init(&vm, mem, MEM_SIZE);
+#endif
+	con_open(&con, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, buffered);
+	con.profile = profile;
+	con.snap = snap;
+	con.serve = sock;
+	con.trace = trace;
+	glyph_attach(&vm, &console, &con);
 
 	/* Parse arguments */
 	if (strcmp(argv[1], "-e") == 0) {
@@ -108,15 +522,45 @@ int main(int argc, char **argv) {
 			fprintf(stderr, "Error: -e requires code argument\n");
 			return 1;
 		}
-		load_string(argv[2]);
+		if (load_string(&vm, argv[2]) < 0)
+			return 1;
+	} else if (strcmp(argv[1], "-i") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "Error: -i requires an image argument\n");
+			return 1;
+		}
+		if (load_image(&vm, argv[2]) < 0)
+			return 1;
 	} else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
-		usage(argv[0]);
+		usage(prog);
 		return 0;
 	} else {
-		if (load_file(argv[1]) < 0)
+		if (load_file(&vm, argv[1]) < 0)
+			return 1;
+	}
+	if (rec || play) {
+		log = fopen(rec ? rec : play, rec ? "wb" : "rb");
+		if (!log || !(rec ? glyph_record(&vm, &rp, log) : glyph_replay(&vm, &rp, log))) {
+			fprintf(stderr, "Error: cannot %s '%s'\n", rec ? "write" : "replay",
+				rec ? rec : play);
 			return 1;
+		}
 	}
 
 	glyph_eval(&vm);
+	flush_all(&con);
+	if (con.profile) prof_report(&vm);
+	if (con.trace) trace_save(&vm, &con);
+	if (log) {
+		if (!glyph_replay_end(&vm, &rp)) {
+			fprintf(stderr, "Error: cannot write '%s'\n", rec);
+			return 1;
+		}
+		if (rp.err) {
+			fprintf(stderr, "Error: replay stopped after %llu hears: %s\n",
+				(unsigned long long)rp.events, rp.err);
+			return 1;
+		}
+	}
 	return 0;
 }
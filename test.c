@@ -1,18 +1,51 @@
 /* Glyph VM tests */
 #define GLYPH_IMPL
 #include "glyph.h"
+#include "glyph_sched.h"
+#include "glyph_replay.h"
+#include "glyph_load.h"
+#include "glyph_mem.h"
+#include "tools/glyphc.h"
+#if GLYPH_BITS == 8
+#include "glyph_batch.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 
 #define TEST(name) static int test_##name(void)
-#define RUN(name) printf("%-20s", #name); if (!test_##name()) {printf("OK\n");}
+#define RUN(name) printf("%-20s", #name); switch (test_##name()) { \
+	case 0: printf("OK\n"); break; case SKIP: printf("SKIP\n"); break; default: fails++; }
+#define SKIP (-1)
 #define ASSERT(x) do { if(!(x)) { printf("FAIL: %s\n", #x); return 1; } } while(0)
 
 static Glyph vm;
-static void run(const char *prog) {
+static int fails;
+#if GLYPH_BITS > 8
+static u8 mem[1 << 12];
+#endif
+
+static void load(const char *prog) {
+#if GLYPH_BITS > 8
+	memset(mem, 0, sizeof(mem));
+	glyph_init(&vm, mem, sizeof(mem));
+#else
 	bzero(&vm, sizeof(vm));
+#endif
 	memcpy(vm.m, prog, strlen(prog) + 1);
+}
+
+static void run(const char *prog) {
+	load(prog);
 	glyph_eval(&vm);
 }
 
@@ -34,7 +67,7 @@ TEST(bitwise) {
 	ASSERT(vm.r['c'] == 7);
 	ASSERT(vm.r['d'] == 15);
 	ASSERT(vm.r['e'] == 8);
-	ASSERT(vm.r['f'] == (uint8_t)~15u);
+	ASSERT(vm.r['f'] == (GlyphWord)~15u);
 	return 0;
 }
 
@@ -46,6 +79,17 @@ TEST(shifts) {
 	return 0;
 }
 
+TEST(long_shifts) {
+#if GLYPH_BITS > 8
+	run("4=a 40<a=c 40>a=d");
+#else
+	run("4=a 9<a=c 8>a=d");
+#endif
+	ASSERT(vm.r['c'] == 0);
+	ASSERT(vm.r['d'] == 0);
+	return 0;
+}
+
 TEST(memory) {
 	run("'*=b '2@>b@<c");
 	ASSERT(vm.r['c'] == '*');
@@ -56,10 +100,8 @@ TEST(memory) {
 TEST(ports) {
 	run("'c=b 5#>b");
 	ASSERT(vm.p[5] == 99);
-	bzero(&vm, sizeof(vm));
-	const char test[] = "10#<b";
+	load("10#<b");
 	vm.p[10] = 77;
-	memcpy(vm.m, test, sizeof(test));
 	glyph_eval(&vm);
 	ASSERT(vm.r['b'] == 77);
 	return 0;
@@ -132,6 +174,53 @@ TEST(nested_calls) {
 	return 0;
 }
 
+TEST(self_modify) {
+	/* second pass runs the rewritten digit at address 3 */
+	run(".L 5=c 1=o '7=v 3@>v +no=n 2?!n L=:. `");
+	ASSERT(vm.m[3] == '7');
+	ASSERT(vm.r['n'] == 2);
+	ASSERT(vm.r['c'] == 7);
+	/* a poke at the last digit of a blank-led immediate reaches the
+	 * entry the blanks folded into, as glyph_step sees it */
+	load("       123=a `");
+	glyph_eval(&vm);
+	ASSERT(vm.r['a'] == 123);
+	glyph_poke(&vm, 9, '9');
+	vm.halt = 0;
+	vm.r['.'] = 0;
+	glyph_eval(&vm);
+	ASSERT(vm.r['a'] == 129);
+	load("       129=a `");
+	while (!vm.halt)
+		glyph_step(&vm);
+	ASSERT(vm.r['a'] == 129);
+	return 0;
+}
+
+#if defined(GLYPH_JIT) && defined(__x86_64__) && defined(__linux__)
+TEST(jit_selfmod) {
+	/* a loop that rewrites a digit inside itself every pass: the JIT
+	 * stops translating over that byte instead of once a pass */
+	GlyphJit *j = glyph_jit_new();
+	ASSERT(j);
+	load("1=o 10=t 48=z .L %it=d +dz=d 35@>d 0=k +sk=s +io=i "
+		"0?!i L=:. +co=c 32?!c L=:. `");
+	glyph_jit_run(j, &vm);
+	ASSERT(vm.halt && vm.r['c'] == 32);
+	ASSERT(vm.r['s'] == (u8)(32 * (256 / 10 * 45 + 15)));
+	ASSERT(j->made < 32);
+	glyph_jit_free(j);
+	return 0;
+}
+#endif
+
+TEST(jump_into_fused) {
+	/* lands on "2=a", the tail of the blank-folded " 12=a" */
+	run("5=. 12=a `");
+	ASSERT(vm.r['a'] == 2);
+	return 0;
+}
+
 TEST(copy) {
 	run("'*=a ab");
 	ASSERT(vm.r['b'] == 42);
@@ -147,11 +236,597 @@ TEST(labels) {
 	return 0;
 }
 
+/* A forward jump, a call, a counted loop and a putchar, assembled for the
+ * whole void and run; returns the program's size or 0 */
+static uint32_t glyphc_sum(bool layout, uint32_t *add, uint32_t *main) {
+	static uint8_t buf[SIZE];
+	uint32_t size = 0;
+	GlyphAsm g;
+	glyph_init_asm(&g, buf, sizeof(buf));
+#if GLYPH_BITS > 8
+	g.size = sizeof(mem);
+#endif
+	G_LOAD(&g, 'o', 1);
+	G_JUMP_LABEL(&g, "main");
+	G_LABEL(&g, "add");
+	G_ADD(&g, 's', 's', 'i');
+	G_RET(&g);
+	G_LABEL(&g, "main");
+	G_LOAD(&g, 'n', 10);
+	G_LABEL(&g, "loop");
+	G_CALL_LABEL(&g, "add");
+	G_ADD(&g, 'i', 'i', 'o');
+	G_JNE_LABEL(&g, 'i', 'n', "loop");
+	G_PUTCHAR(&g, 's');
+	G_HALT(&g);
+	if ((!layout || glyph_layout(&g) == 0) && glyph_resolve(&g) == 0) {
+		*add = glyph_find_label(&g, "add");
+		*main = glyph_find_label(&g, "main");
+		load("");
+		memcpy(vm.m, buf, g.pos);
+		glyph_eval(&vm);
+		if (vm.halt && vm.r['i'] == 10 && vm.r['s'] == 45 && vm.p['c'] == 45)
+			size = g.pos;
+	}
+	glyph_free_asm(&g);
+	return size;
+}
+
+TEST(glyphc) {
+	uint32_t add, main, size;
+	/* relaxed: the jump to main is "14=." */
+	size = glyphc_sum(false, &add, &main);
+	ASSERT(size == 46);
+	ASSERT(add == 7);
+	ASSERT(main == 14);
+	/* laid out: main follows the entry and the jump is gone */
+	ASSERT(glyphc_sum(true, &add, &main) == size - 4);
+	ASSERT(main == 3);
+	ASSERT(add == size - 4 - 7);
+	return 0;
+}
+
+TEST(load) {
+	static u8 big[sizeof(vm) + (1 << 12) + 1];
+	char path[64];
+	int fd[2], n;
+	/* from memory: a new book replaces one the engines have run */
+	run("7=a");
+	ASSERT(glyph_read(&vm, "5=a", 3));
+	vm.halt = 0;
+	vm.r['.'] = 0;
+	glyph_eval(&vm);
+	ASSERT(vm.r['a'] == 5);
+	ASSERT(!glyph_read(&vm, big, sizeof(big)));
+	/* from a pipe */
+	load("");
+	ASSERT(pipe(fd) == 0);
+	ASSERT(write(fd[1], "6=b", 3) == 3);
+	close(fd[1]);
+	ASSERT(glyph_load_fd(&vm, fd[0]) == NULL);
+	close(fd[0]);
+	glyph_eval(&vm);
+	ASSERT(vm.r['b'] == 6);
+	/* from a file, which wide builds map; then too long, then empty */
+	snprintf(path, sizeof(path), "/tmp/glyph-load-%d", (int)getpid());
+	ASSERT((n = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) >= 0);
+	ASSERT(write(n, "8=c", 3) == 3);
+	load("");
+	ASSERT(glyph_load(&vm, path) == NULL);
+	glyph_eval(&vm);
+	ASSERT(vm.r['c'] == 8);
+	ASSERT(vm.m[3] == 0);
+#if GLYPH_BITS > 8
+	/* loading again unmaps the first mapping */
+	{
+		u8 *first = vm.map;
+		ASSERT(first && vm.m == first);
+		ASSERT(glyph_load(&vm, path) == NULL);
+		ASSERT(vm.map && vm.map != first && vm.m == vm.map);
+		ASSERT(msync(first, 1, MS_ASYNC) != 0);
+		glyph_unload(&vm);
+		ASSERT(!vm.map && !vm.m);
+	}
+#endif
+	/* from the offset of the fd, which is then read rather than mapped */
+	load("");
+	ASSERT(lseek(n, 2, SEEK_SET) == 2);
+	ASSERT(glyph_load_fd(&vm, n) == NULL);
+	ASSERT(vm.m[0] == 'c' && vm.m[1] == 0);
+	/* a read that fails past the void still flushes what it overwrote */
+	run("7=a");
+	memset(big, ' ', GLYPH_VOID(&vm) + 1);
+	memcpy(big, "5=a`", 4);
+	ASSERT(pipe(fd) == 0);
+	ASSERT(write(fd[1], big, GLYPH_VOID(&vm) + 1) == GLYPH_VOID(&vm) + 1);
+	close(fd[1]);
+	ASSERT(glyph_load_fd(&vm, fd[0]) != NULL);
+	close(fd[0]);
+	vm.halt = 0;
+	vm.r['.'] = 0;
+	glyph_eval(&vm);
+	ASSERT(vm.r['a'] == 5);
+	ASSERT(write(n, big, sizeof(big)) == sizeof(big));
+	ASSERT(glyph_load(&vm, path) != NULL);
+	ASSERT(ftruncate(n, 0) == 0);
+	ASSERT(glyph_load(&vm, path) != NULL);
+	close(n);
+	unlink(path);
+	ASSERT(glyph_load(&vm, path) != NULL);
+	return 0;
+}
+
+TEST(budget) {
+	/* slices of 7 runes reach the same end and count every rune */
+	const char *prog = ".L 1=o +no=n 200?!n L=:. `";
+	uint64_t runes = 0;
+	int st, slices = 0;
+	load(prog);
+	while (!vm.halt) {
+		glyph_step(&vm);
+		runes++;
+	}
+	load(prog);
+	while ((st = glyph_step_n(&vm, 7)) == GLYPH_BUDGET)
+		slices++;
+	ASSERT(st == GLYPH_HALT);
+	ASSERT(vm.r['n'] == 200);
+	ASSERT(vm.n == runes);
+	ASSERT(slices > 100);
+	return 0;
+}
+
+static int waits;
+static void hear_late(Glyph *g, u8 p) {
+	if (waits++ < 2) g->wait = 1;
+	else g->p[p] = 42;
+}
+
+TEST(wait) {
+	/* no input the first two times: '#<' is left to run again */
+	load("5#<b `");
+	vm.h = hear_late;
+	waits = 0;
+	ASSERT(glyph_step_n(&vm, 100) == GLYPH_WAIT);
+	ASSERT(vm.r['.'] == 1);
+	ASSERT(vm.r['='] == 5);
+	glyph_eval(&vm);
+	ASSERT(!vm.halt && vm.r['.'] == 1);
+	glyph_eval(&vm);
+	ASSERT(vm.halt);
+	ASSERT(vm.r['b'] == 42);
+	return 0;
+}
+
+typedef struct {
+	int sum, n;
+} Tally;
+
+static void tally_emit(Glyph *g, void *ctx, u8 p) {
+	Tally *t = ctx;
+	t->sum += g->p[p];
+	t->n++;
+}
+
+static void tally_hear(Glyph *g, void *ctx, u8 p) {
+	g->p[p] = ((Tally *)ctx)->n;
+}
+
+static const GlyphDevice tally = {
+	.emit = { [7] = tally_emit },
+	.hear = { [7] = tally_hear },
+};
+
+TEST(device) {
+	/* one table, a context per VM; port 8 has no handler */
+	Tally t1 = {0, 0}, t2 = {0, 0};
+	load("5=a 7#>a 7#>a 8#>a 7#<b");
+	glyph_attach(&vm, &tally, &t1);
+	glyph_eval(&vm);
+	ASSERT(t1.sum == 10 && t1.n == 2);
+	ASSERT(vm.r['b'] == 2);
+	load("9=a 7#>a 7#<b");
+	glyph_attach(&vm, &tally, &t2);
+	glyph_eval(&vm);
+	ASSERT(t2.sum == 9 && t2.n == 1);
+	ASSERT(vm.r['b'] == 1);
+	ASSERT(t1.n == 2);
+	return 0;
+}
+
+static Glyph inner;
+#if GLYPH_BITS > 8
+static u8 inner_mem[SIZE];
+#endif
+
+/* Runs a second VM to halt on the same thread, inside the first one's
+ * emit. */
+static void nest_emit(Glyph *g, u8 p) {
+	(void)g; (void)p;
+#if GLYPH_BITS > 8
+	memset(inner_mem, 0, sizeof(inner_mem));
+	glyph_init(&inner, inner_mem, sizeof(inner_mem));
+#else
+	bzero(&inner, sizeof(inner));
+#endif
+	memcpy(inner.m, "1=o .L 'R#>o 7=b `", 18);
+	glyph_eval(&inner);
+}
+
+TEST(nested_eval) {
+	/* the outer loop runs twice around an inner VM with code of its own
+	 * at the same addresses */
+	load("1=o .L 'Q#>o 5=a +no=n 2?!n L=:. `");
+	vm.e = nest_emit;
+	glyph_eval(&vm);
+	ASSERT(vm.r['a'] == 5 && vm.r['b'] == 0 && vm.r['n'] == 2);
+	ASSERT(inner.r['b'] == 7);
+	return 0;
+}
+
+static const GlyphDevice memdev = { .emit = { [GLYPH_MEM_PORT] = glyph_mem } };
+
+TEST(mem) {
+	load("150=f 200=t 5=n 'T#>t 'F#>f 'L#>n 'c=k 'M#>k 'M#<r "
+		"'==k 'M#>k 'M#<s 'x=f 'F#>f 'f=k 'M#>k `");
+	memcpy(vm.m + 150, "hello", 5);
+	glyph_attach(&vm, &memdev, NULL);
+	glyph_eval(&vm);
+	ASSERT(vm.r['r'] == 5 && vm.r['s'] == 0);
+	ASSERT(!memcmp(vm.m + 150, "hello", 5));
+	ASSERT(!memcmp(vm.m + 200, "xxxxx", 5));
+
+	/* ranges are cut at the end of the void; '=' orders by the first
+	 * byte that differs */
+	memcpy(vm.m + 100, "abc", 3);
+	memcpy(vm.m + 110, "abd", 3);
+	vm.p['T'] = 100, vm.p['F'] = 110, vm.p['L'] = 3, vm.p['M'] = '=';
+	glyph_mem(&vm, NULL, 'M');
+	ASSERT(vm.p['M'] == (GlyphWord)-1);
+	vm.p['L'] = 2, vm.p['M'] = '=';
+	glyph_mem(&vm, NULL, 'M');
+	ASSERT(vm.p['M'] == 0);
+	vm.p['T'] = GLYPH_VOID(&vm) - 3, vm.p['F'] = 'z', vm.p['L'] = 9, vm.p['M'] = 'f';
+	glyph_mem(&vm, NULL, 'M');
+	ASSERT(vm.p['M'] == 3 && vm.m[GLYPH_VOID(&vm) - 1] == 'z' && vm.m[0] == '1');
+
+	/* 's' and 'a' leave the offset of the first byte found, or the count
+	 * searched */
+	memcpy(vm.m + 150, "key,val\n", 8);
+	memcpy(vm.m + 200, ",\n", 2);
+	vm.p['F'] = 150, vm.p['L'] = 8, vm.p['N'] = '\n', vm.p['M'] = 's';
+	glyph_mem(&vm, NULL, 'M');
+	ASSERT(vm.p['M'] == 7);
+	vm.p['N'] = 'z', vm.p['M'] = 's';
+	glyph_mem(&vm, NULL, 'M');
+	ASSERT(vm.p['M'] == 8);
+	vm.p['T'] = 200, vm.p['N'] = 2, vm.p['M'] = 'a';
+	glyph_mem(&vm, NULL, 'M');
+	ASSERT(vm.p['M'] == 3);
+
+	/* vector and bitmap searches against a byte at a time */
+	srand(7);
+	for (int t = 0; t < 2000; t++) {
+		uint32_t k = rand() % 24, n = rand() % 120, want = n;
+		for (int i = 0; i < 120; i++)
+			vm.m[i] = 'a' + rand() % 26;
+		for (uint32_t i = 0; i < k; i++)
+			vm.m[200 + i] = 'a' + rand() % 40;
+		for (uint32_t i = 0; i < n && want == n; i++)
+			if (memchr(vm.m + 200, vm.m[i], k))
+				want = i;
+		vm.p['F'] = 0, vm.p['L'] = n, vm.p['T'] = 200, vm.p['N'] = k, vm.p['M'] = 'a';
+		glyph_mem(&vm, NULL, 'M');
+		ASSERT(vm.p['M'] == want);
+	}
+
+	/* the second pass runs the "7=a" copied over "1=a" */
+	load(".b 1=a 'c=k 'M#>k 1=i +oi=o 2?!o b=:. `");
+	memcpy(vm.m + 200, "7=a", 3);
+	vm.p['T'] = 3, vm.p['F'] = 200, vm.p['L'] = 3;
+	glyph_attach(&vm, &memdev, NULL);
+	glyph_eval(&vm);
+	ASSERT(vm.r['a'] == 7 && vm.r['o'] == 2);
+	return 0;
+}
+
+#define TASKS 48
+static GlyphTask tasks[TASKS];
+static _Atomic int boxes[TASKS], halted;
+#if GLYPH_BITS > 8
+static u8 tmem[TASKS][SIZE];
+#endif
+
+static void task_load(int i, const char *prog) {
+	GlyphTask *t = &tasks[i];
+	memset(t, 0, sizeof(*t));
+#if GLYPH_BITS > 8
+	memset(tmem[i], 0, SIZE);
+	glyph_init(&t->vm, tmem[i], SIZE);
+#endif
+	memcpy(t->vm.m, prog, strlen(prog) + 1);
+	t->arg = &boxes[i];
+}
+
+static void hear_box(Glyph *g, u8 p) {
+	_Atomic int *box = ((GlyphTask *)g)->arg;
+	if (!*box) g->wait = 1;
+	else g->p[p] = *box;
+}
+
+static void task_done(GlyphTask *t) {
+	(void)t;
+	halted++;
+}
+
+static GlyphWord heard;
+
+static void hear_count(Glyph *g, u8 p) {
+	g->p[p] = ++heard * 7;
+}
+
+TEST(replay) {
+	/* record three hears, then replay them with no device at all */
+	const char *prog = "'k#<a 'k#<b 'k#<c +ab=s +sc=s `";
+	FILE *f = tmpfile();
+	GlyphReplay rp;
+	ASSERT(f);
+	load(prog);
+	vm.h = hear_count;
+	ASSERT(glyph_record(&vm, &rp, f));
+	glyph_eval(&vm);
+	ASSERT(glyph_replay_end(&vm, &rp) && rp.events == 3);
+	ASSERT(vm.h == hear_count && vm.r['s'] == 42);
+	rewind(f);
+	load(prog);
+	ASSERT(glyph_replay(&vm, &rp, f));
+	glyph_eval(&vm);
+	glyph_replay_end(&vm, &rp);
+	ASSERT(!rp.err && vm.r['s'] == 42);
+	/* one hear more than the log holds */
+	rewind(f);
+	load("'k#<a 'k#<b 'k#<c 'k#<d 5=s `");
+	ASSERT(glyph_replay(&vm, &rp, f));
+	glyph_eval(&vm);
+	ASSERT(rp.err && rp.events == 3 && vm.r['s'] == 0);
+	fclose(f);
+	return 0;
+}
+
+static u8 image[1 << 14];
+
+static size_t snapped;
+static void emit_snap(Glyph *g, u8 p) {
+	(void)p;
+	snapped = glyph_snapshot(g, image, sizeof(image));
+}
+
+TEST(snapshot) {
+	/* halt once with a value on the stack, go on from the image */
+	const char *prog = "5=a 3=b +ab=c 'S#>c +ca=d 9=i .L 1=o -io=i 0?!i L=:. `";
+	uint64_t runes = 0, all;
+	size_t len;
+	run("5=a 3=b +ab=c 9=, ` +ca=d ,==e `");
+	len = glyph_snapshot(&vm, image, sizeof(image));
+	ASSERT(len == glyph_image_size(&vm));
+	ASSERT(glyph_snapshot(&vm, image, len - 1) == 0);
+	load("");
+	ASSERT(glyph_restore(&vm, image, len));
+	ASSERT(vm.halt && vm.r['c'] == 8 && vm.T == 1);
+	vm.halt = 0;
+	glyph_eval(&vm);
+	ASSERT(vm.r['d'] == 13);
+	ASSERT(vm.r['e'] == 9);
+	ASSERT(!glyph_restore(&vm, image, len - 1));
+	image[4]++;
+	ASSERT(!glyph_restore(&vm, image, len));
+	image[4]--;
+#if GLYPH_BITS > 8
+	/* the adopting VM runs in the image itself */
+	ASSERT(glyph_adopt(&vm, image, len));
+	ASSERT(vm.m == image + len - sizeof(mem));
+	vm.halt = 0;
+	glyph_eval(&vm);
+	ASSERT(vm.r['d'] == 13);
+#endif
+	/* an image taken on an emit mid-run has the runes run so far, and
+	 * one resumed from it ends on the count of an unbroken run */
+	load(prog);
+	while (!vm.halt) {
+		glyph_step(&vm);
+		runes++;
+	}
+	load(prog);
+	vm.e = emit_snap;
+	snapped = 0;
+	while (glyph_step_n(&vm, 1000) == GLYPH_BUDGET)
+		;
+	all = vm.n;
+	ASSERT(all == runes && snapped);
+	load("");
+	ASSERT(glyph_restore(&vm, image, snapped));
+	ASSERT(vm.n == 11 && vm.r['c'] == 8);
+	while (glyph_step_n(&vm, 1000) == GLYPH_BUDGET)
+		;
+	ASSERT(vm.n == all && vm.r['d'] == 13);
+	return 0;
+}
+
+TEST(sched) {
+	/* loops that take many slices at any width, and readers parked
+	 * until fed */
+	GlyphSched *s = glyph_sched_new(4, task_done);
+	ASSERT(s);
+	halted = 0;
+	for (int i = 0; i < TASKS; i++) {
+		boxes[i] = 0;
+		if (i % 4)
+			task_load(i, "1=o .A +mo=m 0=n .B +no=n 250?!n B=:. +ko=k 40?!k A=:. `");
+		else
+			task_load(i, "99#<a `");
+		tasks[i].vm.h = hear_box;
+		glyph_sched_add(s, &tasks[i]);
+	}
+	for (int i = 0; i < TASKS; i += 4) {
+		boxes[i] = i + 1;
+		glyph_sched_wake(s, &tasks[i]);
+	}
+	glyph_sched_drain(s);
+	glyph_sched_free(s);
+	ASSERT(halted == TASKS);
+	for (int i = 0; i < TASKS; i++) {
+		ASSERT(tasks[i].vm.halt);
+		if (i % 4)
+			ASSERT(tasks[i].vm.r['m'] == 40);
+		else
+			ASSERT(tasks[i].vm.r['a'] == (GlyphWord)(i + 1));
+	}
+	return 0;
+}
+
+/* Send in to the server at path, shut our side and read the reply into
+ * out; -1 if it does not come within two seconds. */
+static int serve_ask(const char *path, const char *in, char *out, int cap) {
+	struct sockaddr_un a = { .sun_family = AF_UNIX };
+	struct pollfd p;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0), n = 0, r;
+	strcpy(a.sun_path, path);
+	for (int i = 0; connect(fd, (struct sockaddr *)&a, sizeof(a)); i++) {
+		if (i == 200) {
+			close(fd);
+			return -1;
+		}
+		nanosleep(&(struct timespec){ 0, 10000000 }, NULL);
+	}
+	if (write(fd, in, strlen(in)) != (ssize_t)strlen(in))
+		n = -1;
+	shutdown(fd, SHUT_WR);
+	p.fd = fd;
+	p.events = POLLIN;
+	while (n >= 0 && n < cap && poll(&p, 1, 2000) == 1 &&
+	    (r = read(fd, out + n, cap - n)) > 0)
+		n += r;
+	if (n >= 0 && poll(&p, 1, 0) == 0)
+		n = -1;	/* still open: no reply came */
+	close(fd);
+	return n;
+}
+
+TEST(fork_server) {
+	/* a fork that emits on 'S' again must not serve again; runs the
+	 * emulator, which make builds first */
+	char path[64], out[8];
+	pid_t pid;
+	int n1, n2;
+	if (access("./glyph", X_OK))
+		return SKIP;
+	snprintf(path, sizeof(path), "/tmp/glyph-serve-%d", (int)getpid());
+	unlink(path);
+	if ((pid = fork()) == 0) {
+		setpgid(0, 0);
+		execl("./glyph", "glyph", "-F", path, "-e",
+			"'S#>x 'S#>x 'c#<v 'c#>v `", (char *)NULL);
+		_exit(127);
+	}
+	ASSERT(pid > 0);
+	setpgid(pid, pid);
+	n1 = serve_ask(path, "k", out, sizeof(out));
+	n2 = n1 == 1 ? serve_ask(path, "j", out + 1, sizeof(out) - 1) : -1;
+	kill(-pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(path);
+	ASSERT(n1 == 1 && n2 == 1);
+	ASSERT(out[0] == 'k' && out[1] == 'j');
+	return 0;
+}
+
+#ifdef GLYPH_PROFILE
+TEST(profile) {
+	/* three passes of a loop that calls F and rings port 7 */
+	load(".L 40=f ;f 1=o +no=n 3?!n L=:. `");
+	memcpy(vm.m + 40, "7#>a ,.", 8);
+	glyph_eval(&vm);
+	ASSERT(vm.prof.at[0] == 1);
+	ASSERT(vm.prof.at[3] == 3);
+	ASSERT(vm.prof.rune[';'] == 3);
+	ASSERT(vm.prof.call[40] == 3);
+	ASSERT(vm.prof.out[7] == 3);
+	ASSERT(vm.prof.rune['`'] == 1);
+	return 0;
+}
+#endif
+
+#ifdef GLYPH_TRACE
+TEST(trace) {
+	/* more runes than the ring holds, the newest kept; the decoded
+	 * engine records a fused run by its first rune, the JIT a block */
+	FILE *f = tmpfile();
+	uint64_t n;
+	GlyphTraceRec *t;
+	run("1=o .L +io=i 0?!i L=:. +co=c 20?!c L=:. `");
+	n = vm.tn;
+	ASSERT(n > GLYPH_TRACE_SIZE && vm.r['c'] == 20);
+	t = &vm.trace[(n - 1) & (GLYPH_TRACE_SIZE - 1)];
+#if defined(GLYPH_JIT) && defined(__x86_64__) && defined(__linux__)
+	ASSERT(t->op == ' ' && t->pc == 6 && t->T == 0);
+#else
+	ASSERT(t->op == '`' && t->pc == 40 && t->T == 0);
+	t = &vm.trace[(n - 3) & (GLYPH_TRACE_SIZE - 1)];
+#if defined(GLYPH_DECODED) || defined(GLYPH_JIT)
+	ASSERT(t->op == ' ' && t->pc == 34 && t->acc == 20);
+#else
+	ASSERT(t->op == ':' && t->flg == 0);
+#endif
+#endif
+	ASSERT(f && glyph_trace_write(&vm, f));
+	ASSERT(ftell(f) == 20 + (GLYPH_TRACE_SIZE - 1) * (3 * sizeof(GlyphWord) + 2));
+	fclose(f);
+	return 0;
+}
+#endif
+
+#if GLYPH_BITS == 8
+static GlyphBatch batch;
+
+TEST(batch) {
+	/* a trip count per lane: the lanes split and meet again at the exit */
+	const char *prog = ".L +si=s 1=o -io=i 0?!i L=:. 3*s=t `";
+	glyph_batch_load(&batch, (const u8 *)prog, strlen(prog));
+	for (int l = 0; l < GLYPH_LANES; l++)
+		batch.r['i'][l] = l % 5 + 1;
+	glyph_batch_run(&batch);
+	for (int l = 0; l < GLYPH_LANES; l++) {
+		load(prog);
+		vm.r['i'] = l % 5 + 1;
+		glyph_eval(&vm);
+		ASSERT(batch.halt[l]);
+		ASSERT(batch.r['s'][l] == vm.r['s']);
+		ASSERT(batch.r['t'][l] == vm.r['t']);
+	}
+	ASSERT(batch.spilled == 0);
+	return 0;
+}
+#endif
+
+#if GLYPH_BITS > 8
+TEST(wide) {
+	/* 16-bit sums, and a jump past the first 256 bytes */
+	load("200=a 200=b +ab=c 300=.");
+	memcpy(vm.m + 300, "7=d `", 5);
+	glyph_eval(&vm);
+	ASSERT(vm.r['c'] == 400);
+	ASSERT(vm.r['d'] == 7);
+	ASSERT(vm.r['.'] == 305);
+	return 0;
+}
+#endif
+
 int main(void) {
 	printf("Glyph VM Tests\n==============\n");
 	RUN(arithmetic);
 	RUN(bitwise);
 	RUN(shifts);
+	RUN(long_shifts);
 	RUN(memory);
 	RUN(ports);
 	RUN(stack);
@@ -163,8 +838,36 @@ int main(void) {
 	RUN(conditional_lt);
 	RUN(call_return);
 	RUN(nested_calls);
+	RUN(self_modify);
+#if defined(GLYPH_JIT) && defined(__x86_64__) && defined(__linux__)
+	RUN(jit_selfmod);
+#endif
+	RUN(jump_into_fused);
 	RUN(copy);
 	RUN(labels);
+	RUN(glyphc);
+	RUN(load);
+	RUN(budget);
+	RUN(wait);
+	RUN(device);
+	RUN(mem);
+	RUN(nested_eval);
+	RUN(snapshot);
+	RUN(replay);
+	RUN(sched);
+	RUN(fork_server);
+#ifdef GLYPH_PROFILE
+	RUN(profile);
+#endif
+#ifdef GLYPH_TRACE
+	RUN(trace);
+#endif
+#if GLYPH_BITS == 8
+	RUN(batch);
+#endif
+#if GLYPH_BITS > 8
+	RUN(wide);
+#endif
 	printf("==============\n");
-	return 0;
+	return fails != 0;
 }
@@ -0,0 +1,431 @@
+/*
+ * glyph2c - translate a Glyph program into C
+ *
+ * Every address the program can reach becomes a label and every rune a
+ * few lines of C against locals for '.', '=', '?' and the vessels it
+ * names, so the C compiler can fold immediates and jumps. Writes to '.'
+ * go through a switch on the address. Anything the translation does not
+ * cover falls back to glyph_eval on the same Glyph:
+ *   - a jump to an address that was not translated,
+ *   - a write that changes a byte under translated code, or a device
+ *     write over it (seen through vm->gen, with the code in vm->tm),
+ *   - a void that no longer matches the translated image.
+ * Runes that name '=', '?', '.' or ',' as operands run through
+ * glyph_step in place.
+ *
+ * The output includes glyph.h (build with -I pointing at it) and, unless
+ * -l is given, a main() with the console device of main.c.
+ *
+ * Usage: ./glyph2c [-l] [-n name] <program.g> [out.c]
+ *   -l  library only: no main()
+ *   -n  name of the generated function (default glyph_run)
+ */
+
+#define GLYPH_IMPL
+#include "../glyph.h"
+#include "../glyph_load.h"
+#include <stdlib.h>
+
+static Glyph vm;
+static FILE *out;
+
+/* ── Reachability ────────────────────────────────────────────────────── */
+
+/* '=' on entry to each rune: -1 unseen, 0..255 known, 256 unknown. */
+static int accin[SIZE];
+static u8 work[SIZE], queued[SIZE];
+static int nwork;
+static u8 lbl[SIZE][SIZE];	/* lbl[r][x]: a reachable rune sets r = x */
+static u8 via[SIZE];		/* a reachable jump goes through r */
+static u8 cal[SIZE];		/* a reachable ';' at x - 1 */
+static bool ret, pushes, wild;
+
+static void reach(u8 x, int acc) {
+	int old = accin[x], nv = old < 0 || old == acc ? acc : 256;
+	if (nv == old) return;
+	accin[x] = nv;
+	if (!queued[x]) {
+		queued[x] = 1;
+		work[nwork++] = x;
+	}
+}
+
+static void jump_via(u8 r) {
+	via[r] = 1;
+	for (int x = 0; x < SIZE; x++)
+		if (lbl[r][x]) reach(x, 256);
+}
+
+static void set_lbl(u8 r, u8 x) {
+	if (lbl[r][x]) return;
+	lbl[r][x] = 1;
+	if (via[r]) reach(x, 256);
+}
+
+static void set_cal(u8 x) {
+	if (cal[x]) return;
+	cal[x] = 1;
+	if (ret) reach(x, 256);
+}
+
+/* Follow a rune that decoded as GD_SLW: the forms that write '.' or push. */
+static void slow(u8 x, const GlyphOp *d) {
+	u8 op = vm.m[x], a = d->a, b = d->b;
+	if ((op == ',' && a != '.') || (op == '=' && a == ',') ||
+	    (op == ':' && a == ',') || ((op == '@' || op == '#') && a == '<' &&
+	    b == ',') || (glyph_cls[op] == GK_CPY && a == ','))
+		pushes = 1;
+	if (op == ',' && a == '.') {
+		ret = 1;
+		for (int y = 0; y < SIZE; y++)
+			if (cal[y]) reach(y, 256);
+		return;
+	}
+	if (op == ';' || (glyph_cls[op] == GK_CPY && a == '.') ||
+	    ((op == '@' || op == '#') && a == '<' && b == '.')) {
+		wild = 1;
+		return;
+	}
+	if (op == ':')
+		reach(x + 1, 0);
+	reach(x + d->len, 256);
+}
+
+static void analyse(void) {
+	memset(accin, -1, sizeof(accin));
+	reach(0, 0);
+	while (nwork) {
+		u8 x = work[--nwork];
+		int acc = accin[x];
+		GlyphOp d;
+		queued[x] = 0;
+		glyph_decode_rune(&vm, x, &d);
+		switch (d.k) {
+		case GD_SLW: slow(x, &d); break;
+		case GD_STO:
+			if (acc < 256) set_lbl(d.a, acc);
+			/* fall through */
+		case GD_NOP: reach(x + d.len, 0); break;
+		case GD_IMM:
+			reach(x + d.len, acc > 255 ? 256 : (u8)(acc * d.mul + d.add));
+			break;
+		case GD_LIT: reach(x + d.len, d.a); break;
+		case GD_JMP:
+			if (acc > 255) wild = 1;
+			else reach(acc, 0);
+			break;
+		case GD_CMV:
+			if (acc < 256) set_lbl(d.a, acc);
+			reach(x + 1, 0);
+			reach(x + 2, 0);
+			break;
+		case GD_CJP:
+			reach(x + 1, 0);
+			if (acc > 255) wild = 1;
+			else reach(acc, 0);
+			break;
+		case GD_CAL: set_cal(x + 1); jump_via(d.a); break;
+		case GD_JPR: jump_via(d.b); break;
+		case GD_HLT: break;
+		case GD_LBL: set_lbl(d.a, x + 2); reach(x + 2, acc); break;
+		case GD_MLD: case GD_MST: case GD_CEQ: case GD_CNE: case GD_CLT:
+		case GD_CGT: case GD_CPY: case GD_SKP:
+			reach(x + d.len, acc);
+			break;
+		default: reach(x + d.len, 256); break;
+		}
+	}
+	if (ret && pushes)
+		wild = 1;
+}
+
+/* ── Emission ────────────────────────────────────────────────────────── */
+
+static bool live(int x) { return wild || accin[x] >= 0; }
+
+static u8 used[SIZE];	/* vessels held in locals */
+static bool resumes, halts, stores, slowst, ports;
+static u8 cover[SIZE];	/* bytes read by a translated rune */
+
+static void note(u8 r) {
+	if (!glyph_special(r)) used[r] = 1;
+}
+
+static void scan(void) {
+	for (int x = 0; x < SIZE; x++) {
+		GlyphOp d;
+		if (!live(x)) continue;
+		glyph_decode_rune(&vm, x, &d);
+		for (int i = 0; i < d.len || i < 1; i++)
+			cover[(u8)(x + i)] = 1;
+		stores |= d.k == GD_MST;
+		ports |= d.k == GD_PIN || d.k == GD_POU;
+		slowst |= d.k == GD_SLW && vm.m[x] == '@' && d.a == '>';
+		switch (d.k) {
+		case GD_ADD: case GD_SUB: case GD_MUL: case GD_DIV: case GD_MOD:
+		case GD_AND: case GD_OR: case GD_XOR: case GD_CPY:
+			note(d.a); note(d.b); break;
+		case GD_STO: case GD_SHL: case GD_SHR: case GD_NOT: case GD_CMV:
+		case GD_CAL: case GD_LBL:
+			note(d.a); break;
+		case GD_MLD: case GD_MST: case GD_PIN: case GD_POU: case GD_CEQ:
+		case GD_CNE: case GD_CLT: case GD_CGT: case GD_CPA: case GD_JPR:
+			note(d.b); break;
+		}
+	}
+}
+
+/* The rune's bytes, safe inside a comment. */
+static void show(u8 x, int len) {
+	char prev = 0;
+	fputs("/* ", out);
+	for (int i = 0; i < len; i++) {
+		u8 c = vm.m[(u8)(x + i)];
+		if (c < ' ' || c > '~') {
+			fprintf(out, "\\%o", c);
+			c = 0;
+		} else {
+			if (prev == '*' && c == '/') fputc(' ', out);
+			fputc(c, out);
+		}
+		prev = c;
+	}
+	fputs(" */", out);
+}
+
+static void rune(u8 x) {
+	static const char *bin[] = {
+		[GD_ADD] = "+", [GD_SUB] = "-", [GD_MUL] = "*", [GD_AND] = "&",
+		[GD_OR] = "|", [GD_XOR] = "^",
+	};
+	static const char *cmp[] = {
+		[GD_CEQ] = "==", [GD_CNE] = "!=", [GD_CLT] = "<", [GD_CGT] = ">",
+	};
+	GlyphOp d;
+	int mul = 1, imm = 0;
+	glyph_decode_rune(&vm, x, &d);
+	fprintf(out, "L%d:\t", x);
+	show(x, d.len ? d.len : 1);
+	fputs("\n\t", out);
+	switch (d.k) {
+	case GD_NOP: fputs("acc = 0;", out); break;
+	case GD_IMM:
+		for (int i = 0; i < d.len; i++) {
+			mul *= 10;
+			imm = imm * 10 + vm.m[(u8)(x + i)] - '0';
+		}
+		fprintf(out, "acc = acc * %d + %d;", mul, imm);
+		break;
+	case GD_STO: fprintf(out, "r%d = acc; acc = 0;", d.a); break;
+	case GD_JMP: fputs("pc = acc; acc = 0; goto dispatch;", out); break;
+	case GD_LIT: fprintf(out, "acc = %d;", d.a); break;
+	case GD_ADD: case GD_SUB: case GD_MUL: case GD_AND: case GD_OR:
+	case GD_XOR:
+		fprintf(out, "acc = r%d %s r%d;", d.a, bin[d.k], d.b);
+		break;
+	case GD_DIV: case GD_MOD:
+		fprintf(out, "acc = r%d ? r%d %c r%d : 0;", d.b, d.a,
+			d.k == GD_DIV ? '/' : '%', d.b);
+		break;
+	case GD_SHL: case GD_SHR:
+		fprintf(out, "acc = acc > 7 ? 0 : r%d %s acc;", d.a,
+			d.k == GD_SHL ? "<<" : ">>");
+		break;
+	case GD_NOT: fprintf(out, "acc = ~r%d;", d.a); break;
+	case GD_MLD: fprintf(out, "r%d = vm->m[acc];", d.b); break;
+	case GD_MST:
+		fprintf(out, "if (vm->m[acc] != r%d) {\n"
+			"\t\tvm->m[acc] = r%d;\n"
+			"\t\tif (cover[acc]) { pc = %d; goto bail; }\n\t}",
+			d.b, d.b, (u8)(x + 3));
+		break;
+	case GD_PIN:
+		resumes = true;
+		fprintf(out, "pc = %d; SYNC(); gen = vm->gen;\n"
+			"\tif (vm->h) vm->h(vm, acc);\n\tLOAD();\n"
+			"\tif (vm->wait) { pc = %d; SYNC(); return; }\n"
+			"\tr%d = vm->p[acc];\n"
+			"\tif (vm->gen != gen) goto bail;\n"
+			"\tif (vm->halt || pc != %d) goto resume;",
+			(u8)(x + 3), x, d.b, (u8)(x + 3));
+		break;
+	case GD_POU:
+		resumes = true;
+		fprintf(out, "vm->p[acc] = r%d;\n"
+			"\tpc = %d; SYNC(); gen = vm->gen;\n"
+			"\tif (vm->e) vm->e(vm, acc);\n\tLOAD();\n"
+			"\tif (vm->gen != gen) goto bail;\n"
+			"\tif (vm->halt || pc != %d) goto resume;",
+			d.b, (u8)(x + 3), (u8)(x + 3));
+		break;
+	case GD_CEQ: case GD_CNE: case GD_CLT: case GD_CGT:
+		fprintf(out, "flg = acc %s r%d;", cmp[d.k], d.b);
+		break;
+	case GD_CMV:
+		fprintf(out, "if (flg) { r%d = acc; acc = 0; goto L%d; }\n"
+			"\tacc = 0;", d.a, (u8)(x + 2));
+		break;
+	case GD_CJP:
+		fputs("if (flg) { pc = acc; acc = 0; goto dispatch; }\n"
+			"\tacc = 0;", out);
+		break;
+	case GD_CAL:
+		fprintf(out, "vm->s[vm->T++] = %d; pc = r%d; goto dispatch;",
+			(u8)(x + 1), d.a);
+		break;
+	case GD_CPY: fprintf(out, "r%d = r%d;", d.a, d.b); break;
+	case GD_CPA: fprintf(out, "acc = r%d;", d.b); break;
+	case GD_JPR: fprintf(out, "pc = r%d; goto dispatch;", d.b); break;
+	case GD_LBL: fprintf(out, "r%d = %d;", d.a, (u8)(x + 2)); break;
+	case GD_SKP: fputs(";", out); break;
+	case GD_HLT:
+		fprintf(out, "pc = %d; goto halt;", (u8)(x + 1));
+		halts = true;
+		break;
+	case GD_SLW:
+		if (vm.m[x] == '@' && d.a == '>')
+			fputs("at = acc; was = vm->m[at];\n\t", out);
+		fprintf(out, "pc = %d; SYNC(); glyph_step(vm); LOAD();\n\t", x);
+		if (vm.m[x] == '#' && d.a == '<')
+			fputs("if (vm->wait) return;\n\t", out);
+		if (vm.m[x] == '@' && d.a == '>')
+			fputs("if (vm->m[at] != was && cover[at]) goto bail;\n\t", out);
+		fputs("goto resume;", out);
+		resumes = true;
+		break;
+	}
+	switch (d.k) {
+	case GD_JMP: case GD_CAL: case GD_JPR: case GD_HLT: case GD_SLW:
+		break;
+	case GD_CMV: case GD_CJP:
+		if ((u8)(x + 1) == 0)
+			fputs("\n\tgoto L0;", out);
+		break;
+	default:
+		if ((u8)(x + d.len) != x + 1)
+			fprintf(out, "\n\tgoto L%d;", (u8)(x + d.len));
+	}
+	fputc('\n', out);
+}
+
+static void table(const char *name, const u8 *v) {
+	fprintf(out, "static const u8 %s[SIZE] = {", name);
+	for (int i = 0; i < SIZE; i++)
+		fprintf(out, "%s%d,", i % 16 ? " " : "\n\t", v[i]);
+	fputs("\n};\n\n", out);
+}
+
+static const char *device =
+"static void emit(Glyph *vm, u8 prt) {\n"
+"\tswitch (prt) {\n"
+"\tcase 'c': putchar(vm->p['c']); fflush(stdout); break;\n"
+"\tcase 'e': fputc(vm->p['e'], stderr); fflush(stderr); break;\n"
+"\tcase 'X': exit(vm->p['X']);\n"
+"\tcase 'M': glyph_mem(vm, NULL, prt); break;\n"
+"\t}\n"
+"}\n"
+"\n"
+"static void hear(Glyph *vm, u8 prt) {\n"
+"\tif (prt == 'c') {\n"
+"\t\tint ch = getchar();\n"
+"\t\tvm->p['c'] = ch == EOF ? 0 : (char)ch;\n"
+"\t}\n"
+"}\n"
+"\n"
+"int main(void) {\n"
+"\tstatic Glyph vm;\n"
+"\tvm.e = emit;\n"
+"\tvm.h = hear;\n"
+"\tmemcpy(vm.m, image, SIZE);\n"
+"\t%s(&vm);\n"
+"\treturn 0;\n"
+"}\n";
+
+static void emit_c(const char *src, const char *name, bool lib) {
+	fprintf(out, "/* %s, translated by glyph2c */\n", src);
+	fputs("#define GLYPH_IMPL\n#include \"glyph.h\"\n", out);
+	if (!lib)
+		fputs("#include \"glyph_mem.h\"\n", out);
+	fputs("#include <stdlib.h>\n\n", out);
+	table("image", vm.m);
+	if (stores || slowst || ports)
+		table("cover", cover);
+	fprintf(out, "#define SYNC() (vm->r['.'] = pc, vm->r['='] = acc, "
+		"vm->r['?'] = flg");
+	for (int r = 0; r < SIZE; r++)
+		if (used[r]) fprintf(out, ", \\\n\tvm->r[%d] = r%d", r, r);
+	fprintf(out, ")\n#define LOAD() (pc = vm->r['.'], acc = vm->r['='], "
+		"flg = vm->r['?']");
+	for (int r = 0; r < SIZE; r++)
+		if (used[r]) fprintf(out, ", \\\n\tr%d = vm->r[%d]", r, r);
+	fputs(")\n\n", out);
+
+	fprintf(out, "void %s(Glyph *vm) {\n", name);
+	fputs(slowst ? "\tu8 pc, acc, flg, at, was;\n" : "\tu8 pc, acc, flg;\n", out);
+	if (ports)
+		fputs("\tunsigned gen;\n", out);
+	for (int r = 0; r < SIZE; r++)
+		if (used[r]) fprintf(out, "\tu8 r%d;\n", r);
+	fputs("\tLOAD();\n"
+		"\tvm->wait = 0;\n"
+		"\tif (vm->halt) return;\n"
+		"\tif (memcmp(vm->m, image, SIZE)) goto bail;\n", out);
+	if (ports)
+		fputs("\tfor (int i = 0; i < SIZE; i++)\n"
+			"\t\tif (cover[i]) vm->tm[i >> 3] |= 1 << (i & 7);\n", out);
+	fputs("dispatch:\n"
+		"\tswitch (pc) {\n", out);
+	for (int x = 0; x < SIZE; x++)
+		if (live(x)) fprintf(out, "\tcase %d: goto L%d;\n", x, x);
+	fputs("\tdefault: goto bail;\n\t}\n", out);
+	for (int x = 0; x < SIZE; x++)
+		if (live(x)) rune(x);
+	if (resumes)
+		fputs("resume:\n"
+			"\tif (vm->halt) { SYNC(); return; }\n"
+			"\tgoto dispatch;\n", out);
+	if (halts)
+		fputs("halt:\n"
+			"\tvm->halt = 1;\n"
+			"\tSYNC();\n"
+			"\treturn;\n", out);
+	fputs("bail:\n"
+		"\tSYNC();\n"
+		"\tglyph_flush(vm);\n"
+		"\tglyph_eval(vm);\n"
+		"}\n", out);
+	if (!lib) {
+		fputc('\n', out);
+		fprintf(out, device, name);
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *name = "glyph_run";
+	bool lib = false;
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-l"))
+			lib = true;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			name = argv[++i];
+	}
+	if (i == argc) {
+		fprintf(stderr, "Usage: %s [-l] [-n name] <program.g> [out.c]\n", argv[0]);
+		return 1;
+	}
+	const char *err = glyph_load(&vm, argv[i]);
+	if (err) {
+		fprintf(stderr, "glyph2c: '%s' %s\n", argv[i], err);
+		return 1;
+	}
+	out = stdout;
+	if (i + 1 < argc && !(out = fopen(argv[i + 1], "w"))) {
+		fprintf(stderr, "glyph2c: cannot write '%s'\n", argv[i + 1]);
+		return 1;
+	}
+	analyse();
+	scan();
+	emit_c(argv[i], name, lib);
+	return out != stdout && fclose(out) != 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * glyph2c_test - run glyph2c_test.g translated with -l against a hear
+ * that has no input the first two times. Its '#<' names '=', so it runs
+ * through glyph_step; the translation must stop on wait as glyph_eval
+ * does and run the rune again on the next call.
+ */
+
+#include "glyph2c_test.aot.c"
+
+#define ASSERT(x) do { if(!(x)) { printf("FAIL: %s\n", #x); return 1; } } while(0)
+
+static int calls;
+
+static void hear(Glyph *vm, u8 prt) {
+	if (calls++ < 2) vm->wait = 1;
+	else vm->p[prt] = 42;
+}
+
+int main(void) {
+	static Glyph vm;
+	vm.h = hear;
+	memcpy(vm.m, image, SIZE);
+	printf("%-20s", "glyph2c_wait");
+	glyph_run(&vm);
+	ASSERT(!vm.halt && vm.wait && vm.r['.'] == 2 && calls == 1);
+	glyph_run(&vm);
+	ASSERT(!vm.halt && vm.wait && vm.r['.'] == 2 && calls == 2);
+	glyph_run(&vm);
+	ASSERT(vm.halt && vm.r['a'] == 42 && calls == 3);
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1 @@
+'k#<==a `
\ No newline at end of file
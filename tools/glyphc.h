@@ -1,45 +1,72 @@
 /*
  * glyphc.h - Glyph Assembler Library
  * 
- * A C library for generating Glyph bytecode with automatic label resolution.
+ * A C library for generating Glyph runes with automatic label resolution.
+ * Every emitter writes the runes glyph_eval runs, and picks the shortest
+ * bytes for each immediate: it tracks whether '=' is known to be 0, which
+ * lets a constant be bare digits, and otherwise uses a literal 'X or a
+ * blank and digits. Vessel '=' is the accumulator, '.' the pc, '?' the
+ * flag and ',' the stack; GLYPH_TMP is clobbered by some emitters.
+ *
+ * A label reference takes no bytes until glyph_resolve, which gives each
+ * one the shortest form of its final address: until then G_HERE and
+ * glyph_find_label count the bytes emitted so far, not addresses.
  * 
  * Usage:
  *   GlyphAsm g;
  *   glyph_init_asm(&g, buffer, sizeof(buffer));
  *   
  *   // Emit instructions
- *   G_LOAD_HEX(&g, 'a', 5);      // :ax5
- *   G_LOAD_LIT(&g, 'b', 'H');    // :bgH
- *   G_ADD(&g, 'c', 'a', 'b');    // +cab
+ *   G_LOAD(&g, 'a', 5);          // 5=a
+ *   G_LOAD_LIT(&g, 'b', 'H');    // 'H=b
+ *   G_ADD(&g, 'c', 'a', 'b');    // +ab=c
  *   
  *   // Labels
  *   G_LABEL(&g, "loop");
- *   G_READ_PORT(&g, 'v', 'p');   // #<vp
- *   G_JUMP_LABEL(&g, "loop");    // Emits code to jump to "loop"
+ *   G_GETCHAR(&g, 'v');          // 'c#<v
+ *   G_JUMP_LABEL(&g, "loop");    // 'L=. (shortest form of the address)
  *   
+ *   glyph_layout(&g);            // Optional: chain blocks along jumps
  *   glyph_resolve(&g);           // Fix up label addresses
  *   glyph_write(&g, "out.glyph");
+ *   glyph_free_asm(&g);          // Free labels and references
  */
 
 #ifndef GLYPHC_H
 #define GLYPHC_H
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-#define GLYPH_MAX_LABELS 128
-#define GLYPH_MAX_REFS   256
+/* Label names are interned once each in an arena of chunks that is
+ * freed as a whole by glyph_free_asm. */
+#define GLYPH_ARENA_CHUNK 4096
+
+typedef struct GlyphChunk {
+    struct GlyphChunk *next;
+    size_t used, size;
+    char data[];
+} GlyphChunk;
 
 typedef struct {
-    char name[32];
+    const char *name;   /* interned */
+    uint32_t hash;
     uint32_t addr;
+    int nref;           /* references emitted before the definition */
+    int defined;
 } GlyphLabel;
 
+/* A field loading a label into '='; the same followed by "=." (a jump);
+ * the end of a block that does not fall through, which takes no bytes */
+enum { GLYPH_REF_IMM, GLYPH_REF_JUMP, GLYPH_REF_END };
+
 typedef struct {
-    char name[32];
-    uint32_t addr;      /* Address where the 16-bit value should go */
-    char reg;           /* Register to load the address into */
+    uint32_t label;     /* index into labels */
+    uint32_t addr;      /* bytes emitted before the field */
+    uint8_t kind;
+    uint8_t acc_zero;   /* '=' is 0 before the field */
 } GlyphLabelRef;
 
 typedef struct {
@@ -47,11 +74,20 @@ typedef struct {
     uint32_t size;
     uint32_t pos;
     
-    GlyphLabel labels[GLYPH_MAX_LABELS];
-    int label_count;
+    /* Labels in order of first mention, found through an open-addressed
+     * table of label index + 1 (0 is an empty slot) kept under 3/4 full */
+    GlyphLabel *labels;
+    int label_count, label_cap;
+    uint32_t *index;
+    uint32_t index_cap;
     
-    GlyphLabelRef refs[GLYPH_MAX_REFS];
-    int ref_count;
+    GlyphLabelRef *refs;
+    int ref_count, ref_cap;
+    
+    GlyphChunk *arena;
+    int acc_zero;       /* '=' is 0 here on every path */
+    int full;           /* bytes were dropped at the end of buf */
+    int oom;            /* an allocation failed; glyph_resolve fails */
 } GlyphAsm;
 
 /* Initialize assembler */
@@ -60,107 +96,301 @@ static inline void glyph_init_asm(GlyphAsm *g, uint8_t *buf, uint32_t size) {
     g->buf = buf;
     g->size = size;
     g->pos = 0;
+    g->acc_zero = 1;
+}
+
+/* Free the label table, references and interned names */
+static inline void glyph_free_asm(GlyphAsm *g) {
+    while (g->arena) {
+        GlyphChunk *c = g->arena;
+        g->arena = c->next;
+        free(c);
+    }
+    free(g->labels);
+    free(g->index);
+    free(g->refs);
+    g->labels = NULL;
+    g->index = NULL;
+    g->refs = NULL;
+    g->label_count = g->label_cap = g->ref_count = g->ref_cap = 0;
+    g->index_cap = 0;
 }
 
 /* Emit a single byte */
 static inline void G_EMIT(GlyphAsm *g, uint8_t b) {
     if (g->pos < g->size) g->buf[g->pos++] = b;
+    else g->full = 1;
 }
 
-/* Current address (with base offset) */
+/* Bytes emitted so far; an address only once glyph_resolve has run */
 static inline uint32_t G_HERE(GlyphAsm *g) {
     return g->pos;
 }
 
-/* Define a label at current position */
+static inline char *glyph_arena_copy(GlyphAsm *g, const char *s, size_t n) {
+    GlyphChunk *c = g->arena;
+    if (!c || c->size - c->used < n + 1) {
+        size_t size = n + 1 > GLYPH_ARENA_CHUNK ? n + 1 : GLYPH_ARENA_CHUNK;
+        if (!(c = malloc(sizeof(*c) + size)))
+            return NULL;
+        c->next = g->arena;
+        c->used = 0;
+        c->size = size;
+        g->arena = c;
+    }
+    char *p = c->data + c->used;
+    memcpy(p, s, n);
+    p[n] = 0;
+    c->used += n + 1;
+    return p;
+}
+
+/* FNV-1a */
+static inline uint32_t glyph_label_hash(const char *name, size_t *len) {
+    uint32_t h = 2166136261u;
+    size_t n = 0;
+    for (; name[n]; n++)
+        h = (h ^ (uint8_t)name[n]) * 16777619u;
+    *len = n;
+    return h;
+}
+
+/* Slot of name in the index: the one holding it, or the empty one where
+ * it would go */
+static inline uint32_t glyph_label_slot(GlyphAsm *g, const char *name, uint32_t h) {
+    uint32_t mask = g->index_cap - 1, i = h & mask;
+    for (; g->index[i]; i = (i + 1) & mask) {
+        GlyphLabel *l = &g->labels[g->index[i] - 1];
+        if (l->hash == h && strcmp(l->name, name) == 0)
+            break;
+    }
+    return i;
+}
+
+static inline int glyph_label_grow(GlyphAsm *g) {
+    uint32_t cap = g->index_cap ? g->index_cap * 2 : 256;
+    uint32_t *index = calloc(cap, sizeof(*index));
+    if (!index)
+        return -1;
+    for (int i = 0; i < g->label_count; i++) {
+        uint32_t j = g->labels[i].hash & (cap - 1);
+        while (index[j])
+            j = (j + 1) & (cap - 1);
+        index[j] = i + 1;
+    }
+    free(g->index);
+    g->index = index;
+    g->index_cap = cap;
+    return 0;
+}
+
+/* Index of label name, added undefined if new; -1 when out of memory */
+static inline int glyph_intern(GlyphAsm *g, const char *name) {
+    size_t len;
+    uint32_t h = glyph_label_hash(name, &len), slot;
+    if ((uint64_t)(g->label_count + 1) * 4 > (uint64_t)g->index_cap * 3 &&
+        glyph_label_grow(g) < 0)
+        goto oom;
+    slot = glyph_label_slot(g, name, h);
+    if (g->index[slot])
+        return g->index[slot] - 1;
+    if (g->label_count == g->label_cap) {
+        int cap = g->label_cap ? g->label_cap * 2 : 64;
+        GlyphLabel *l = realloc(g->labels, cap * sizeof(*l));
+        if (!l)
+            goto oom;
+        g->labels = l;
+        g->label_cap = cap;
+    }
+    GlyphLabel *l = &g->labels[g->label_count];
+    if (!(l->name = glyph_arena_copy(g, name, len)))
+        goto oom;
+    l->hash = h;
+    l->addr = 0;
+    l->defined = 0;
+    g->index[slot] = ++g->label_count;
+    return g->label_count - 1;
+oom:
+    g->oom = 1;
+    return -1;
+}
+
+/* Define a label at current position; the first definition holds.
+ * Jumps arrive with any '=' */
 static inline void G_LABEL(GlyphAsm *g, const char *name) {
-    if (g->label_count < GLYPH_MAX_LABELS) {
-        strncpy(g->labels[g->label_count].name, name, 31);
-        g->labels[g->label_count].addr = G_HERE(g);
-        g->label_count++;
+    int i = glyph_intern(g, name);
+    g->acc_zero = 0;
+    if (i >= 0 && !g->labels[i].defined) {
+        g->labels[i].addr = G_HERE(g);
+        g->labels[i].nref = g->ref_count;
+        g->labels[i].defined = 1;
     }
 }
 
 /* Find label address (returns 0 if not found) */
 static inline uint32_t glyph_find_label(GlyphAsm *g, const char *name) {
-    for (int i = 0; i < g->label_count; i++) {
-        if (strcmp(g->labels[i].name, name) == 0)
-            return g->labels[i].addr;
+    size_t len;
+    uint32_t h, slot;
+    if (!g->index_cap)
+        return 0;
+    h = glyph_label_hash(name, &len);
+    slot = glyph_label_slot(g, name, h);
+    if (!g->index[slot])
+        return 0;
+    return g->labels[g->index[slot] - 1].addr;
+}
+
+/* Record a reference at the current position */
+static inline void glyph_ref(GlyphAsm *g, int kind, int label) {
+    if (label < 0) return;
+    if (g->ref_count == g->ref_cap) {
+        int cap = g->ref_cap ? g->ref_cap * 2 : 64;
+        GlyphLabelRef *r = realloc(g->refs, cap * sizeof(*r));
+        if (!r) {
+            g->oom = 1;
+            return;
+        }
+        g->refs = r;
+        g->ref_cap = cap;
     }
-    return 0;
+    g->refs[g->ref_count].label = label;
+    g->refs[g->ref_count].addr = g->pos;
+    g->refs[g->ref_count].kind = kind;
+    g->refs[g->ref_count].acc_zero = g->acc_zero;
+    g->ref_count++;
+}
+
+/* Flow does not fall through here; what follows is reached by jumps */
+static inline void glyph_end_block(GlyphAsm *g) {
+    glyph_ref(g, GLYPH_REF_END, 0);
+    g->acc_zero = 0;
 }
 
 /* ─────────────────────────────────────────────────────────────────────────
  * Basic Instructions
  * ───────────────────────────────────────────────────────────────────────── */
 
-/* :agX - Load literal byte into register */
-static inline void G_LOAD_LIT(GlyphAsm *g, char reg, uint8_t val) {
-    G_EMIT(g, ':'); G_EMIT(g, reg); G_EMIT(g, 'g'); G_EMIT(g, val);
+#define GLYPH_TMP '_'   /* scratch vessel */
+
+/* Whether c names a vessel that can lead a copy rune "ab" (b = a):
+ * any byte that is not a rune of its own */
+static inline int glyph_plain(char c) {
+    return !strchr(" \f\n\v\r\t0123456789='+-*/%&|^<>~@#?:;`", c);
+}
+
+static inline int glyph_digits(uint32_t v) {
+    int n = 1;
+    for (; v >= 10; v /= 10) n++;
+    return n;
 }
 
-/* :axN - Load hex digit (0-15) into register */
-static inline void G_LOAD_HEX(GlyphAsm *g, char reg, uint8_t hex) {
-    G_EMIT(g, ':'); G_EMIT(g, reg); G_EMIT(g, 'x');
-    G_EMIT(g, (hex < 10) ? ('0' + hex) : ('a' + hex - 10));
+/* Bytes of '=' <- v in the fewest: digits if '=' is 0, a literal 'X for
+ * a byte that would take more than two, else a blank to clear '=' first */
+static inline int glyph_imm_cost(uint32_t v, int zero) {
+    int cost = glyph_digits(v) + !zero;
+    if (v == 0) return !zero;
+    return v <= 255 && cost > 2 ? 2 : cost;
 }
 
-/* :a.b - Copy register b to a */
+static inline int glyph_imm_bytes(uint8_t *out, uint32_t v, int zero) {
+    int n = glyph_imm_cost(v, zero);
+    if (n == 2 && v <= 255 && glyph_digits(v) + !zero > 2) {
+        out[0] = '\''; out[1] = v;
+        return n;
+    }
+    for (int i = n; i-- > !zero; v /= 10)
+        out[i] = '0' + v % 10;
+    if (!zero && n) out[0] = ' ';
+    return n;
+}
+
+static inline void G_IMM(GlyphAsm *g, uint32_t v) {
+    uint8_t b[12];
+    int n = glyph_imm_bytes(b, v, g->acc_zero);
+    for (int i = 0; i < n; i++) G_EMIT(g, b[i]);
+    g->acc_zero = v == 0;
+}
+
+/* =a - Store '=' into a, which clears '=' */
+static inline void G_SET(GlyphAsm *g, char reg) {
+    if (reg == '=') return;
+    G_EMIT(g, '='); G_EMIT(g, reg);
+    g->acc_zero = 1;
+}
+
+/* a= or |aa - Load vessel a into '=' */
+static inline void G_ACC(GlyphAsm *g, char reg) {
+    if (reg == '=') return;
+    if (glyph_plain(reg)) {
+        G_EMIT(g, reg); G_EMIT(g, '=');
+    } else {
+        G_EMIT(g, '|'); G_EMIT(g, reg); G_EMIT(g, reg);
+    }
+    g->acc_zero = 0;
+}
+
+/* Nn=a - Load a constant into a register, shortest form */
+static inline void G_LOAD(GlyphAsm *g, char reg, uint32_t val) {
+    G_IMM(g, val);
+    G_SET(g, reg);
+}
+
+/* 'X=a - Load literal byte into register */
+static inline void G_LOAD_LIT(GlyphAsm *g, char reg, uint8_t val) {
+    G_EMIT(g, '\''); G_EMIT(g, val);
+    g->acc_zero = 0;
+    G_SET(g, reg);
+}
+
+/* ba - Copy register b to a */
 static inline void G_COPY(GlyphAsm *g, char dst, char src) {
-    G_EMIT(g, ':'); G_EMIT(g, dst); G_EMIT(g, '.'); G_EMIT(g, src);
+    if (dst == src) return;
+    if (src == '=') {
+        G_SET(g, dst);
+    } else if (glyph_plain(src)) {
+        G_EMIT(g, src); G_EMIT(g, dst);
+        if (dst == '=') g->acc_zero = 0;
+    } else {
+        G_ACC(g, src);
+        G_SET(g, dst);
+    }
 }
 
-/* Load 16-bit immediate into register (12 bytes) */
-static inline void G_LOAD16(GlyphAsm *g, char reg, uint16_t val) {
-    uint8_t hh = (val >> 12) & 0xF;
-    uint8_t hl = (val >> 8) & 0xF;
-    uint8_t lh = (val >> 4) & 0xF;
-    uint8_t ll = val & 0xF;
-    
-    /* Use temp registers: reg for high byte build, '~' for low byte build */
-    /* Build: ((hh << 4) | hl) << 8 | ((lh << 4) | ll) */
-    
-    /* High byte into reg */
-    G_LOAD_HEX(g, reg, hh);           /* :Rxhh */
-    G_EMIT(g, '<'); G_EMIT(g, reg); G_EMIT(g, reg); G_EMIT(g, '4'); /* <RR4 - shift left 4 */
-    G_LOAD_HEX(g, '~', hl);           /* :~xhl */
-    G_EMIT(g, '|'); G_EMIT(g, reg); G_EMIT(g, reg); G_EMIT(g, '~'); /* |RR~ - or with low nibble */
-    
-    /* Shift high byte left 8 */
-    G_EMIT(g, '<'); G_EMIT(g, reg); G_EMIT(g, reg); G_EMIT(g, '8'); /* <RR8 */
-    
-    /* Low byte into temp */
-    G_LOAD_HEX(g, '~', lh);           /* :~xlh */
-    G_EMIT(g, '<'); G_EMIT(g, '~'); G_EMIT(g, '~'); G_EMIT(g, '4'); /* <~~4 */
-    G_LOAD_HEX(g, '_', ll);           /* :_xll */
-    G_EMIT(g, '|'); G_EMIT(g, '~'); G_EMIT(g, '~'); G_EMIT(g, '_'); /* |~~_ */
-    
-    /* Combine */
-    G_EMIT(g, '|'); G_EMIT(g, reg); G_EMIT(g, reg); G_EMIT(g, '~'); /* |RR~ */
+/* .a - Set a to the address after the mark, for a later "a." */
+static inline void G_MARK(GlyphAsm *g, char reg) {
+    G_EMIT(g, '.'); G_EMIT(g, reg);
+    g->acc_zero = 0;
 }
 
 /* ─────────────────────────────────────────────────────────────────────────
- * Arithmetic
+ * Arithmetic: +ab=d leaves the result in d and clears '='; a d of '='
+ * keeps it there
  * ───────────────────────────────────────────────────────────────────────── */
 
+static inline void glyph_binop(GlyphAsm *g, char op, char d, char a, char b) {
+    G_EMIT(g, op); G_EMIT(g, a); G_EMIT(g, b);
+    g->acc_zero = 0;
+    G_SET(g, d);
+}
+
 static inline void G_ADD(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '+'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '+', d, a, b);
 }
 
 static inline void G_SUB(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '-'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '-', d, a, b);
 }
 
 static inline void G_MUL(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '*'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '*', d, a, b);
 }
 
 static inline void G_DIV(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '/'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '/', d, a, b);
 }
 
 static inline void G_MOD(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '%'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '%', d, a, b);
 }
 
 /* ─────────────────────────────────────────────────────────────────────────
@@ -168,159 +398,418 @@ static inline void G_MOD(GlyphAsm *g, char d, char a, char b) {
  * ───────────────────────────────────────────────────────────────────────── */
 
 static inline void G_AND(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '&'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '&', d, a, b);
 }
 
 static inline void G_OR(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '|'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '|', d, a, b);
 }
 
 static inline void G_XOR(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '^'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    glyph_binop(g, '^', d, a, b);
 }
 
+/* ~s=d */
 static inline void G_NOT(GlyphAsm *g, char d, char s) {
-    G_EMIT(g, '~'); G_EMIT(g, d); G_EMIT(g, s);
+    G_EMIT(g, '~'); G_EMIT(g, s);
+    g->acc_zero = 0;
+    G_SET(g, d);
 }
 
+/* b=<a=d - Shift a by b; the count goes through '=' */
 static inline void G_SHL(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '<'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    G_ACC(g, b);
+    G_EMIT(g, '<'); G_EMIT(g, a);
+    g->acc_zero = 0;
+    G_SET(g, d);
 }
 
 static inline void G_SHR(GlyphAsm *g, char d, char a, char b) {
-    G_EMIT(g, '>'); G_EMIT(g, d); G_EMIT(g, a); G_EMIT(g, b);
+    G_ACC(g, b);
+    G_EMIT(g, '>'); G_EMIT(g, a);
+    g->acc_zero = 0;
+    G_SET(g, d);
 }
 
 /* ─────────────────────────────────────────────────────────────────────────
- * Memory
+ * Memory: the address goes through '='
  * ───────────────────────────────────────────────────────────────────────── */
 
-/* @ab - Load from memory: a = mem[b] */
+/* b=@<a - Load from memory: a = mem[b] */
 static inline void G_LOAD_MEM(GlyphAsm *g, char dst, char addr) {
-    G_EMIT(g, '@'); G_EMIT(g, dst); G_EMIT(g, addr);
+    G_ACC(g, addr);
+    G_EMIT(g, '@'); G_EMIT(g, '<'); G_EMIT(g, dst);
+    g->acc_zero = 0;
 }
 
-/* !ab - Store to memory: mem[a] = b */
+/* a=@>b - Store to memory: mem[a] = b */
 static inline void G_STORE_MEM(GlyphAsm *g, char addr, char val) {
-    G_EMIT(g, '!'); G_EMIT(g, addr); G_EMIT(g, val);
+    G_ACC(g, addr);
+    G_EMIT(g, '@'); G_EMIT(g, '>'); G_EMIT(g, val);
+    g->acc_zero = 0;
 }
 
 /* ─────────────────────────────────────────────────────────────────────────
- * Ports (Resonance)
+ * Ports (Resonance): the port goes through '='
  * ───────────────────────────────────────────────────────────────────────── */
 
-/* #<ab - Read from port: a = port[b] */
+/* b=#<a - Read from port: a = port[b] */
 static inline void G_READ_PORT(GlyphAsm *g, char dst, char port) {
-    G_EMIT(g, '#'); G_EMIT(g, '<'); G_EMIT(g, dst); G_EMIT(g, port);
+    G_ACC(g, port);
+    G_EMIT(g, '#'); G_EMIT(g, '<'); G_EMIT(g, dst);
+    g->acc_zero = 0;
 }
 
-/* #>ab - Write to port: port[a] = b */
+/* a=#>b - Write to port: port[a] = b */
 static inline void G_WRITE_PORT(GlyphAsm *g, char port, char val) {
-    G_EMIT(g, '#'); G_EMIT(g, '>'); G_EMIT(g, port); G_EMIT(g, val);
+    G_ACC(g, port);
+    G_EMIT(g, '#'); G_EMIT(g, '>'); G_EMIT(g, val);
+    g->acc_zero = 0;
+}
+
+/* 'p#<a - Read from a constant port */
+static inline void G_IN(GlyphAsm *g, char dst, uint8_t port) {
+    G_IMM(g, port);
+    G_EMIT(g, '#'); G_EMIT(g, '<'); G_EMIT(g, dst);
+    g->acc_zero = 0;
+}
+
+/* 'p#>b - Write to a constant port */
+static inline void G_OUT(GlyphAsm *g, uint8_t port, char val) {
+    G_IMM(g, port);
+    G_EMIT(g, '#'); G_EMIT(g, '>'); G_EMIT(g, val);
+    g->acc_zero = 0;
 }
 
 /* ─────────────────────────────────────────────────────────────────────────
  * Control Flow
  * ───────────────────────────────────────────────────────────────────────── */
 
-/* .a - Jump to address in register */
+/* a. - Jump to address in register */
 static inline void G_JUMP(GlyphAsm *g, char reg) {
-    G_EMIT(g, '.'); G_EMIT(g, reg);
+    G_COPY(g, '.', reg);
+    glyph_end_block(g);
 }
 
-/* ;a - Call subroutine at address in register */
+/* ;a  - Call subroutine at address in register. ';' pushes the address
+ * of its operand, so the return runs "a " as a copy into vessel ' ';
+ * an a that is a rune of its own goes through GLYPH_TMP */
 static inline void G_CALL(GlyphAsm *g, char reg) {
-    G_EMIT(g, ';'); G_EMIT(g, reg);
+    if (!glyph_plain(reg)) {
+        G_COPY(g, GLYPH_TMP, reg);
+        reg = GLYPH_TMP;
+    }
+    G_EMIT(g, ';'); G_EMIT(g, reg); G_EMIT(g, ' ');
+    g->acc_zero = 0;
 }
 
-/* , - Return from subroutine */
+/* ,. - Return from subroutine */
 static inline void G_RET(GlyphAsm *g) {
-    G_EMIT(g, ',');
+    G_EMIT(g, ','); G_EMIT(g, '.');
+    glyph_end_block(g);
+}
+
+/* a, - Push a register; ,a - pop into one */
+static inline void G_PUSH(GlyphAsm *g, char reg) {
+    G_COPY(g, ',', reg);
+}
+
+static inline void G_POP(GlyphAsm *g, char reg) {
+    G_EMIT(g, ','); G_EMIT(g, reg);
+    if (reg == '=') g->acc_zero = 0;
+}
+
+/* ` - Halt */
+static inline void G_HALT(GlyphAsm *g) {
+    G_EMIT(g, '`');
+    glyph_end_block(g);
+}
+
+/* a=?cb - Set '?' to a <cmp> b, cmp one of = ! < > */
+static inline void G_CMP(GlyphAsm *g, char cmp, char a, char b) {
+    G_ACC(g, a);
+    G_EMIT(g, '?'); G_EMIT(g, cmp); G_EMIT(g, b);
+    g->acc_zero = 0;
+}
+
+/* a=?cb t=:.  - If a <cmp> b, jump to address in t. Not taken, ':'
+ * leaves its operand to run as ". ", a copy into vessel ' ' */
+static inline void glyph_jcc(GlyphAsm *g, char cmp, char a, char b, char target) {
+    G_CMP(g, cmp, a, b);
+    G_ACC(g, target);
+    G_EMIT(g, ':'); G_EMIT(g, '.'); G_EMIT(g, ' ');
+    g->acc_zero = 1;
 }
 
-/* ?=abt - If a == b, jump to address in t */
 static inline void G_JEQ(GlyphAsm *g, char a, char b, char target) {
-    G_EMIT(g, '?'); G_EMIT(g, '='); G_EMIT(g, a); G_EMIT(g, b); G_EMIT(g, target);
+    glyph_jcc(g, '=', a, b, target);
 }
 
-/* ?!abt - If a != b, jump to address in t */
 static inline void G_JNE(GlyphAsm *g, char a, char b, char target) {
-    G_EMIT(g, '?'); G_EMIT(g, '!'); G_EMIT(g, a); G_EMIT(g, b); G_EMIT(g, target);
+    glyph_jcc(g, '!', a, b, target);
 }
 
-/* ?>abt - If a > b, jump to address in t */
 static inline void G_JGT(GlyphAsm *g, char a, char b, char target) {
-    G_EMIT(g, '?'); G_EMIT(g, '>'); G_EMIT(g, a); G_EMIT(g, b); G_EMIT(g, target);
+    glyph_jcc(g, '>', a, b, target);
 }
 
-/* ?<abt - If a < b, jump to address in t */
 static inline void G_JLT(GlyphAsm *g, char a, char b, char target) {
-    G_EMIT(g, '?'); G_EMIT(g, '<'); G_EMIT(g, a); G_EMIT(g, b); G_EMIT(g, target);
+    glyph_jcc(g, '<', a, b, target);
 }
 
 /* ─────────────────────────────────────────────────────────────────────────
- * Label References (for forward jumps)
+ * Label References
  * ───────────────────────────────────────────────────────────────────────── */
 
-/* Reserve space for a label reference (to be resolved later) */
-static inline void G_LOAD16_LABEL(GlyphAsm *g, char reg, const char *label) {
-    /* Check if label is already defined */
-    uint32_t addr = glyph_find_label(g, label);
-    if (addr) {
-        G_LOAD16(g, reg, addr);
-    } else {
-        /* Record reference for later resolution */
-        if (g->ref_count < GLYPH_MAX_REFS) {
-            strncpy(g->refs[g->ref_count].name, label, 31);
-            g->refs[g->ref_count].addr = g->pos;
-            g->refs[g->ref_count].reg = reg;
-            g->ref_count++;
+/* '=' <- address of label, sized by glyph_resolve */
+static inline void G_IMM_LABEL(GlyphAsm *g, const char *label) {
+    glyph_ref(g, GLYPH_REF_IMM, glyph_intern(g, label));
+    g->acc_zero = 0;
+}
+
+/* Load the address of a label into a register */
+static inline void G_LOAD_LABEL(GlyphAsm *g, char reg, const char *label) {
+    G_IMM_LABEL(g, label);
+    G_SET(g, reg);
+}
+
+/* L=. - Jump to label */
+static inline void G_JUMP_LABEL(GlyphAsm *g, const char *label) {
+    glyph_ref(g, GLYPH_REF_JUMP, glyph_intern(g, label));
+    g->acc_zero = 0;
+}
+
+/* L=_;_  - Call label through GLYPH_TMP */
+static inline void G_CALL_LABEL(GlyphAsm *g, const char *label) {
+    G_LOAD_LABEL(g, GLYPH_TMP, label);
+    G_CALL(g, GLYPH_TMP);
+}
+
+/* a=?cb 'L:.  - If a <cmp> b, jump to label */
+static inline void glyph_jcc_label(GlyphAsm *g, char cmp, char a, char b,
+                                   const char *label) {
+    G_CMP(g, cmp, a, b);
+    G_IMM_LABEL(g, label);
+    G_EMIT(g, ':'); G_EMIT(g, '.'); G_EMIT(g, ' ');
+    g->acc_zero = 1;
+}
+
+static inline void G_JEQ_LABEL(GlyphAsm *g, char a, char b, const char *label) {
+    glyph_jcc_label(g, '=', a, b, label);
+}
+
+static inline void G_JNE_LABEL(GlyphAsm *g, char a, char b, const char *label) {
+    glyph_jcc_label(g, '!', a, b, label);
+}
+
+static inline void G_JGT_LABEL(GlyphAsm *g, char a, char b, const char *label) {
+    glyph_jcc_label(g, '>', a, b, label);
+}
+
+static inline void G_JLT_LABEL(GlyphAsm *g, char a, char b, const char *label) {
+    glyph_jcc_label(g, '<', a, b, label);
+}
+
+typedef struct {
+    uint32_t b0, b1;    /* bytes */
+    int r0, r1;         /* references */
+    int jump;           /* label the block jumps to at its end, or -1 */
+    int falls;          /* runs into the next block */
+} GlyphAsmBlock;
+
+typedef struct {
+    uint32_t addr;
+    int nref, label;
+} GlyphAsmDef;
+
+static inline int glyph_def_cmp(const void *a, const void *b) {
+    const GlyphAsmDef *x = a, *y = b;
+    if (x->nref != y->nref) return x->nref < y->nref ? -1 : 1;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* Reorder blocks so that a jump is followed by its target wherever that
+ * target is not fallen into, and drop the jumps that then lead to the
+ * next byte.
+ * Blocks start at labels and end after "=.", ",.", "`" and "a."; those
+ * that fall into the next stay together, the first stays first and the
+ * one that runs off the end stays last. Addresses computed from G_HERE
+ * do not move with the code. Call before glyph_resolve; -1 when out of
+ * memory. */
+static inline int glyph_layout(GlyphAsm *g) {
+    int nl = 0, nb = 0, n = 0, nr = 0, scan = 1, last, k;
+    int maxb = g->label_count + g->ref_count + 1;
+    uint32_t pos = 0;
+    GlyphAsmDef *defs = malloc((g->label_count + 1) * sizeof(*defs));
+    GlyphAsmBlock *blk = malloc(maxb * sizeof(*blk));
+    int *at = malloc((g->label_count + 1) * sizeof(*at));
+    int *order = malloc(3 * maxb * sizeof(*order));
+    char *keep = malloc(g->ref_count + 1);
+    uint8_t *code = malloc(g->pos + 1);
+    GlyphLabelRef *refs = malloc((g->ref_count + 1) * sizeof(*refs));
+    if (!defs || !blk || !at || !order || !keep || !code || !refs) {
+        g->oom = 1;
+        goto out;
+    }
+    for (int i = 0; i < g->label_count; i++) {
+        at[i] = -1;
+        if (g->labels[i].defined)
+            defs[nl++] = (GlyphAsmDef){ g->labels[i].addr, g->labels[i].nref, i };
+    }
+    qsort(defs, nl, sizeof(*defs), glyph_def_cmp);
+    memset(keep, 1, g->ref_count + 1);
+
+    /* Split at definitions and after references that end a block */
+    blk[0] = (GlyphAsmBlock){ 0, 0, 0, 0, -1, 1 };
+    for (int i = 0, j = 0; ; i++) {
+        for (; j < nl && defs[j].nref <= i; j++) {
+            if (blk[nb].b0 != defs[j].addr || blk[nb].r0 != defs[j].nref) {
+                blk[nb].b1 = defs[j].addr;
+                blk[nb].r1 = defs[j].nref;
+                blk[++nb] = (GlyphAsmBlock){ defs[j].addr, 0, defs[j].nref, 0, -1, 1 };
+            }
+            at[defs[j].label] = nb;
         }
-        /* Emit placeholder (will be patched) */
-        G_LOAD16(g, reg, 0xFFFF);
+        if (i == g->ref_count) {
+            blk[nb].b1 = g->pos;
+            blk[nb++].r1 = i;
+            break;
+        }
+        if (g->refs[i].kind == GLYPH_REF_IMM) continue;
+        blk[nb].b1 = g->refs[i].addr;
+        blk[nb].r1 = i + 1;
+        blk[nb].falls = 0;
+        if (g->refs[i].kind == GLYPH_REF_JUMP) blk[nb].jump = g->refs[i].label;
+        blk[++nb] = (GlyphAsmBlock){ g->refs[i].addr, 0, i + 1, 0, -1, 1 };
+    }
+
+    /* Place chains of blocks that fall into each other, each followed by
+     * the chain its jump leads to when that is still free */
+    int *head = order + maxb, *placed = order + 2 * maxb;
+    for (int i = 0; i < nb; i++) {
+        head[i] = i == 0 || !blk[i - 1].falls;
+        placed[i] = 0;
+    }
+    for (last = nb - 1; !head[last]; last--) ;
+    for (k = 0; n < nb; ) {
+        for (; ; k++) {
+            order[n++] = k;
+            placed[k] = 1;
+            if (!blk[k].falls || k + 1 == nb) break;
+        }
+        int t = blk[k].jump >= 0 ? at[blk[k].jump] : -1;
+        if (t < 0 || placed[t] || !head[t] || t == last) {
+            for (; scan < nb && (placed[scan] || !head[scan] || scan == last); scan++) ;
+            t = scan < nb ? scan : last;
+        }
+        k = t;
     }
-}
 
-/* Resolve all label references */
+    /* Copy the blocks in their new order, without jumps to the next */
+    for (int i = 0; i + 1 < nb; i++)
+        if (blk[order[i]].jump >= 0 && at[blk[order[i]].jump] == order[i + 1])
+            keep[blk[order[i]].r1 - 1] = 0;
+    for (int i = 0; i < nb; i++) {
+        GlyphAsmBlock *b = &blk[order[i]];
+        uint32_t len = b->b1 - b->b0;
+        int r0 = nr;
+        memcpy(code + pos, g->buf + b->b0, len);
+        for (int r = b->r0; r < b->r1; r++) {
+            if (!keep[r]) continue;
+            refs[nr] = g->refs[r];
+            refs[nr++].addr += pos - b->b0;
+        }
+        b->b0 = pos;
+        b->r0 = r0;
+        pos += len;
+    }
+    for (int i = 0; i < g->label_count; i++) {
+        if (at[i] < 0) continue;
+        g->labels[i].addr = blk[at[i]].b0;
+        g->labels[i].nref = blk[at[i]].r0;
+    }
+    memcpy(g->buf, code, pos);
+    memcpy(g->refs, refs, nr * sizeof(*refs));
+    g->pos = pos;
+    g->ref_count = nr;
+out:
+    free(defs); free(blk); free(at); free(order); free(keep); free(code); free(refs);
+    return g->oom ? -1 : 0;
+}
+
+/* Resolve all label references. Each field starts at the size of address
+ * 0 and grows to that of its label's address until no field changes;
+ * addresses only grow, so neither do the sizes, and the fixed point is
+ * reached in a few passes. Then the fields are written in and labels
+ * hold their addresses. */
 static inline int glyph_resolve(GlyphAsm *g) {
-    for (int i = 0; i < g->ref_count; i++) {
-        uint32_t addr = glyph_find_label(g, g->refs[i].name);
-        if (!addr) {
-            fprintf(stderr, "glyphc: undefined label '%s'\n", g->refs[i].name);
+    int nr = g->ref_count, changed = 1;
+    uint32_t *size, *pre, end;
+    if (g->oom) {
+        fprintf(stderr, "glyphc: out of memory\n");
+        return -1;
+    }
+    for (int i = 0; i < nr; i++) {
+        GlyphLabel *l = &g->labels[g->refs[i].label];
+        if (g->refs[i].kind != GLYPH_REF_END && !l->defined) {
+            fprintf(stderr, "glyphc: undefined label '%s'\n", l->name);
             return -1;
         }
-        
-        /* Patch the G_LOAD16 instruction */
-        uint32_t pos = g->refs[i].addr;
-        char reg = g->refs[i].reg;
-        
-        uint8_t hh = (addr >> 12) & 0xF;
-        uint8_t hl = (addr >> 8) & 0xF;
-        uint8_t lh = (addr >> 4) & 0xF;
-        uint8_t ll = addr & 0xF;
-        
-        /* Patch the hex digits in the instruction sequence */
-        /* :Rxhh<RR4:~xhl|RR~<RR8:~xlh<~~4:_xll|~~_|RR~ */
-        /* pos+0: : pos+1: R pos+2: x pos+3: hh */
-        g->buf[pos + 3] = (hh < 10) ? ('0' + hh) : ('a' + hh - 10);
-        /* pos+8: : pos+9: ~ pos+10: x pos+11: hl */
-        g->buf[pos + 11] = (hl < 10) ? ('0' + hl) : ('a' + hl - 10);
-        /* pos+20: : pos+21: ~ pos+22: x pos+23: lh */
-        g->buf[pos + 23] = (lh < 10) ? ('0' + lh) : ('a' + lh - 10);
-        /* pos+28: : pos+29: _ pos+30: x pos+31: ll */
-        g->buf[pos + 31] = (ll < 10) ? ('0' + ll) : ('a' + ll - 10);
-        
-        /* Also patch the register names */
-        g->buf[pos + 1] = reg;
-        g->buf[pos + 5] = reg;
-        g->buf[pos + 6] = reg;
-        g->buf[pos + 13] = reg;
-        g->buf[pos + 14] = reg;
-        g->buf[pos + 17] = reg;
-        g->buf[pos + 18] = reg;
-        g->buf[pos + 37] = reg;
-        g->buf[pos + 38] = reg;
     }
+    size = calloc(nr + 1, sizeof(*size));
+    pre = calloc(nr + 1, sizeof(*pre));
+    uint8_t *code = malloc(g->pos + 1);
+    if (!size || !pre || !code) {
+        free(size); free(pre); free(code);
+        fprintf(stderr, "glyphc: out of memory\n");
+        return -1;
+    }
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < nr; i++)
+            pre[i + 1] = pre[i] + size[i];
+        for (int i = 0; i < nr; i++) {
+            GlyphLabelRef *r = &g->refs[i];
+            GlyphLabel *l = &g->labels[r->label];
+            uint32_t n;
+            if (r->kind == GLYPH_REF_END) continue;
+            n = glyph_imm_cost(l->addr + pre[l->nref], r->acc_zero);
+            n += r->kind == GLYPH_REF_JUMP ? 2 : 0;
+            if (n != size[i]) {
+                size[i] = n;
+                changed = 1;
+            }
+        }
+    }
+    end = g->pos + pre[nr];
+    if (g->full || end > g->size) {
+        free(size); free(pre); free(code);
+        fprintf(stderr, "glyphc: program does not fit in %u bytes\n", g->size);
+        return -1;
+    }
+    
+    /* Write the fields in between the bytes emitted */
+    memcpy(code, g->buf, g->pos);
+    for (int i = nr - 1; i >= 0; i--) {
+        GlyphLabelRef *r = &g->refs[i];
+        GlyphLabel *l = &g->labels[r->label];
+        uint32_t from = r->addr, to = i + 1 < nr ? g->refs[i + 1].addr : g->pos;
+        uint8_t *at = g->buf + from + pre[i];
+        memmove(at + size[i], code + from, to - from);
+        if (r->kind == GLYPH_REF_END) continue;
+        at += glyph_imm_bytes(at, l->addr + pre[l->nref], r->acc_zero);
+        if (r->kind == GLYPH_REF_JUMP) {
+            at[0] = '='; at[1] = '.';
+        }
+    }
+    for (int i = 0; i < g->label_count; i++) {
+        GlyphLabel *l = &g->labels[i];
+        if (l->defined) l->addr += pre[l->nref];
+        l->nref = 0;
+    }
+    g->pos = end;
+    g->ref_count = 0;
+    free(size); free(pre); free(code);
     return 0;
 }
 
@@ -337,27 +826,24 @@ static inline int glyph_write(GlyphAsm *g, const char *path) {
  * Convenience: Common Console Operations
  * ───────────────────────────────────────────────────────────────────────── */
 
-#define CON_WRITE 'o'   /* stdout port */
-#define CON_READ  'c'   /* stdin port */
+#define CON_WRITE 'c'   /* stdout port, as main.c */
+#define CON_READ  'c'   /* stdin port, the same */
 #define CON_ERROR 'e'   /* stderr port */
 
 /* Print character in register to stdout */
 static inline void G_PUTCHAR(GlyphAsm *g, char reg) {
-    G_LOAD_LIT(g, '`', CON_WRITE);
-    G_WRITE_PORT(g, '`', reg);
+    G_OUT(g, CON_WRITE, reg);
 }
 
 /* Read character from stdin into register */
 static inline void G_GETCHAR(GlyphAsm *g, char reg) {
-    G_LOAD_LIT(g, '`', CON_READ);
-    G_READ_PORT(g, reg, '`');
+    G_IN(g, reg, CON_READ);
 }
 
-/* Print immediate character */
+/* Print immediate character through GLYPH_TMP */
 static inline void G_PRINT_CHAR(GlyphAsm *g, char c) {
-    G_LOAD_LIT(g, '`', c);
-    G_LOAD_LIT(g, '[', CON_WRITE);
-    G_WRITE_PORT(g, '[', '`');
+    G_LOAD(g, GLYPH_TMP, (uint8_t)c);
+    G_PUTCHAR(g, GLYPH_TMP);
 }
 
 #endif /* GLYPHC_H */
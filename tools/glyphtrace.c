@@ -0,0 +1,74 @@
+/*
+ * glyphtrace - print a trace written by glyph_trace_write
+ *
+ * One line per rune, oldest first: its number in the run, the address
+ * it was at, the rune, and '=', '?' and the stack depth it started with.
+ * Reads any GLYPH_BITS; see the format next to glyph_trace_write.
+ *
+ * Usage: ./glyphtrace [-n last] <trace>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+static uint64_t le(const unsigned char *p, int n) {
+	uint64_t v = 0;
+	while (n--)
+		v = v << 8 | p[n];
+	return v;
+}
+
+int main(int argc, char **argv) {
+	unsigned char head[20], rec[14];
+	uint64_t last = UINT64_MAX, total, kept, seq;
+	int i = 1, w;
+	if (i + 1 < argc && !strcmp(argv[i], "-n")) {
+		last = strtoull(argv[i + 1], NULL, 10);
+		i += 2;
+	}
+	if (i + 1 != argc) {
+		fprintf(stderr, "Usage: %s [-n last] <trace>\n", argv[0]);
+		return 1;
+	}
+	FILE *f = fopen(argv[i], "rb");
+	if (!f) {
+		fprintf(stderr, "glyphtrace: cannot open '%s'\n", argv[i]);
+		return 1;
+	}
+	if (fread(head, 1, sizeof(head), f) != sizeof(head) ||
+	    memcmp(head, "GLYT", 4) || head[4] != 1 ||
+	    (head[5] != 8 && head[5] != 16 && head[5] != 32)) {
+		fprintf(stderr, "glyphtrace: '%s' is not a glyph trace\n", argv[i]);
+		return 1;
+	}
+	w = head[5] / 8;
+	total = le(head + 8, 8);
+	kept = le(head + 16, 4);
+	seq = total - kept;
+	printf("%llu runes run, last %llu kept\n", (unsigned long long)total,
+		(unsigned long long)kept);
+	printf("%12s %10s %-5s %10s %10s %5s\n", "rune", "pc", "op", "=", "?", "depth");
+	for (; fread(rec, 1, 3 * w + 2, f) == (size_t)(3 * w + 2); seq++) {
+		unsigned op = rec[3 * w];
+		char name[8];
+		if (total - seq > last)
+			continue;
+		if (isgraph(op))
+			snprintf(name, sizeof(name), "%c", op);
+		else
+			snprintf(name, sizeof(name), "\\x%02x", op);
+		printf("%12llu %10llu %-5s %10llu %10llu %5u\n",
+			(unsigned long long)seq, (unsigned long long)le(rec, w), name,
+			(unsigned long long)le(rec + w, w),
+			(unsigned long long)le(rec + 2 * w, w), rec[3 * w + 1]);
+	}
+	fclose(f);
+	if (seq != total) {
+		fprintf(stderr, "glyphtrace: '%s' is cut short\n", argv[i]);
+		return 1;
+	}
+	return 0;
+}
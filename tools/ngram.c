@@ -0,0 +1,137 @@
+/*
+ * ngram - mine Glyph programs for frequent rune sequences
+ *
+ * Decodes each program the way glyph_eval_decoded does (without fusion)
+ * and counts runs of 2..4 consecutive decoded runes. The most frequent
+ * runs are the candidates for superinstructions in glyph_decode.
+ *
+ * Usage: ./ngram [-d] [-n top] <program.g>...
+ *   -d  weight by execution (runs each program for up to 1M runes)
+ *       instead of a static sweep of the bytes
+ */
+
+#define GLYPH_IMPL
+#include "../glyph.h"
+#include <stdlib.h>
+
+#define MAXN 4
+#define MAXG 4096
+
+static const char *kname[GD_N] = {
+	[GD_DTY]="dty", [GD_SLW]="slw", [GD_NOP]="nop", [GD_IMM]="imm",
+	[GD_STO]="sto", [GD_JMP]="jmp", [GD_LIT]="lit", [GD_ADD]="add",
+	[GD_SUB]="sub", [GD_MUL]="mul", [GD_DIV]="div", [GD_MOD]="mod",
+	[GD_AND]="and", [GD_OR]="or",   [GD_XOR]="xor", [GD_SHL]="shl",
+	[GD_SHR]="shr", [GD_NOT]="not", [GD_MLD]="mld", [GD_MST]="mst",
+	[GD_PIN]="pin", [GD_POU]="pou", [GD_CEQ]="ceq", [GD_CNE]="cne",
+	[GD_CLT]="clt", [GD_CGT]="cgt", [GD_CMV]="cmv", [GD_CJP]="cjp",
+	[GD_CAL]="cal", [GD_CPY]="cpy", [GD_CPA]="cpa", [GD_JPR]="jpr",
+	[GD_LBL]="lbl", [GD_SKP]="skp", [GD_HLT]="hlt",
+	[GD_IMS]="ims", [GD_IMJ]="imj", [GD_LTS]="lts", [GD_LTO]="lto",
+	[GD_IEQ]="ieq", [GD_INE]="ine", [GD_ILT]="ilt", [GD_IGT]="igt",
+	[GD_BEQ]="beq", [GD_BNE]="bne", [GD_BLT]="blt", [GD_BGT]="bgt",
+	[GD_CLD]="cld", [GD_CJR]="cjr",
+};
+
+typedef struct {
+	u8 n, k[MAXN];
+	unsigned long count;
+} Gram;
+
+static Gram grams[MAXG];
+static int ngrams;
+static Glyph vm;
+
+static void count(const u8 *k, int n, unsigned long w) {
+	for (int i = 0; i < ngrams; i++)
+		if (grams[i].n == n && !memcmp(grams[i].k, k, n)) {
+			grams[i].count += w;
+			return;
+		}
+	if (ngrams == MAXG)
+		return;
+	grams[ngrams].n = n;
+	memcpy(grams[ngrams].k, k, n);
+	grams[ngrams++].count = w;
+}
+
+/* Slide a window over the decoded rune stream. */
+static u8 win[MAXN];
+static int wlen;
+
+static void push(u8 k) {
+	if (wlen == MAXN) {
+		memmove(win, win + 1, MAXN - 1);
+		wlen--;
+	}
+	win[wlen++] = k;
+	for (int n = 2; n <= wlen; n++)
+		count(win + wlen - n, n, 1);
+}
+
+static void sweep(void) {
+	GlyphOp d;
+	for (int x = 0; x < SIZE; x += d.len) {
+		glyph_decode_rune(&vm, x, &d);
+		if (d.k == GD_HLT && vm.m[x] == 0)
+			break;
+		push(d.k);
+	}
+}
+
+static void trace(void) {
+	GlyphOp d;
+	for (long i = 0; i < 1000000 && !vm.halt; i++) {
+		glyph_decode_rune(&vm, vm.r['.'], &d);
+		push(d.k);
+		/* digit runs execute as one folded rune */
+		if (d.k == GD_IMM) {
+			vm.r['='] = vm.r['='] * d.mul + d.add;
+			vm.r['.'] += d.len;
+		} else {
+			glyph_step(&vm);
+		}
+	}
+}
+
+static int cmp(const void *a, const void *b) {
+	const Gram *x = a, *y = b;
+	return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+	int dyn = 0, top = 20, i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-d"))
+			dyn = 1;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			top = atoi(argv[++i]);
+	}
+	if (i == argc) {
+		fprintf(stderr, "Usage: %s [-d] [-n top] <program.g>...\n", argv[0]);
+		return 1;
+	}
+	for (; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		if (!f) {
+			fprintf(stderr, "ngram: cannot open '%s'\n", argv[i]);
+			return 1;
+		}
+		memset(&vm, 0, sizeof(vm));
+		fread(vm.m, 1, SIZE, f);
+		fclose(f);
+		wlen = 0;
+		if (dyn)
+			trace();
+		else
+			sweep();
+	}
+	qsort(grams, ngrams, sizeof(*grams), cmp);
+	for (i = 0; i < ngrams && i < top; i++) {
+		printf("%8lu ", grams[i].count);
+		for (int j = 0; j < grams[i].n; j++)
+			printf(" %s", kname[grams[i].k[j]]);
+		printf("\n");
+	}
+	return 0;
+}